@@ -53,6 +53,15 @@ typedef struct image_buffer {
     int32_t *buffer;
 } simage_buffer;
 
+/* Number of worker threads used for large operations (fills, resizes, ...), 0 (default) uses
+   one per core and 1 keeps everything on the calling thread */
+void simage_set_thread_count(int count);
+int simage_thread_count(void);
+/* When enabled, resizes, mip generation and blending decode sRGB colors to linear light before
+   mixing them and encode the result again. Off by default */
+void simage_set_gamma_correct(bool enabled);
+bool simage_gamma_correct(void);
+
 bool simage_empty(unsigned int w, unsigned int h, sg_color color, simage_buffer *dst);
 bool simage_load_from_path(const char *path, simage_buffer *dst);
 bool simage_load_from_memory(const void *data, size_t length, simage_buffer *dst);
@@ -60,23 +69,286 @@ void simage_destroy_buffer(simage_buffer *img);
 void simage_pset(simage_buffer *img, int x, int y, sg_color color);
 sg_color simage_pget(simage_buffer *img, int x, int y);
 
+/* Packed 0xRRBBGGAA variants, convert a color once with simage_pack_color and reuse it */
+uint32_t simage_pack_color(sg_color color);
+sg_color simage_unpack_color(uint32_t color);
+void simage_pset_u32(simage_buffer *img, int x, int y, uint32_t color);
+uint32_t simage_pget_u32(simage_buffer *img, int x, int y);
+void simage_set_span(simage_buffer *img, int x, int y, int n, uint32_t color);
+uint32_t* simage_row_ptr(simage_buffer *img, int y);
+
 void simage_fill(simage_buffer *img, sg_color color);
+void simage_fill_rect(simage_buffer *img, int x, int y, int w, int h, sg_color color);
 void simage_flood(simage_buffer *img, int x, int y, sg_color color);
+
+/* tolerance is the largest per-channel difference from the seed color that still gets filled.
+   When mask is set (width * height bytes) matching pixels are marked 255 there and img is left
+   untouched, pixels already non-zero in the mask are treated as filled. rw/rh of 0 = whole image */
+typedef struct simage_flood_desc {
+    int tolerance;
+    bool eight_connected;
+    unsigned char *mask;
+    int rx, ry, rw, rh;
+} simage_flood_desc;
+
+bool simage_flood_ex(simage_buffer *img, int x, int y, sg_color color, const simage_flood_desc *desc);
+
+/* Label connected regions: pixels accepted by predicate (all pixels when NULL) are joined to
+   neighbours whose color is within tolerance. labels (width * height) receives 0 for rejected
+   pixels and 1..n otherwise. stats, if not NULL, receives a malloc'd array of n components.
+   Returns n, or -1 on failure */
+typedef struct simage_label_desc {
+    int tolerance;
+    bool eight_connected;
+    bool(*predicate)(uint32_t color, void *userdata);
+    void *userdata;
+} simage_label_desc;
+
+typedef struct simage_component {
+    int x, y, w, h;
+    size_t area;
+    float cx, cy;
+} simage_component;
+
+int simage_label_components(simage_buffer *img, const simage_label_desc *desc, uint32_t *labels, simage_component **stats);
 void simage_paste(simage_buffer *dst, simage_buffer *src, int x, int y);
 void simage_clipped_paste(simage_buffer *dst, simage_buffer *src, int x, int y, int rx, int ry, int rw, int rh);
+
+/* Straight alpha compositing of src over dst, SIMAGE_BLEND_NONE is a plain copy */
+typedef enum simage_blend_mode {
+    SIMAGE_BLEND_NONE,
+    SIMAGE_BLEND_ALPHA,
+    SIMAGE_BLEND_PREMULTIPLIED,
+    SIMAGE_BLEND_ADD,
+    SIMAGE_BLEND_MULTIPLY,
+    SIMAGE_BLEND_SCREEN
+} simage_blend_mode;
+
+void simage_blend(simage_buffer *dst, simage_buffer *src, int x, int y, simage_blend_mode mode);
+void simage_clipped_blend(simage_buffer *dst, simage_buffer *src, int x, int y, int rx, int ry, int rw, int rh, simage_blend_mode mode);
+
+/* Executes blits in order, binned by destination tile so each tile stays in cache across the
+   blits that touch it, with tiles spread across threads. rw/rh of 0 uses the whole source */
+typedef struct simage_blit_cmd {
+    simage_buffer *src;
+    int x, y;
+    int rx, ry, rw, rh;
+    simage_blend_mode mode;
+} simage_blit_cmd;
+
+void simage_blit_batch(simage_buffer *dst, const simage_blit_cmd *cmds, size_t n);
+
+/* Run-length encoded sprite: each row is a list of transparent (skipped), opaque (copied) and
+   translucent (alpha blended) runs. data holds height + 1 row offsets followed by the runs */
+typedef struct simage_sprite {
+    unsigned int width, height;
+    uint32_t *data;
+} simage_sprite;
+
+bool simage_compile_sprite(simage_buffer *src, simage_sprite *dst);
+void simage_destroy_sprite(simage_sprite *sprite);
+void simage_blit_sprite(simage_buffer *dst, simage_sprite *sprite, int x, int y);
 void simage_resize(simage_buffer *src, int nw, int nh);
 void simage_rotate(simage_buffer *src, float angle);
 void simage_clip(simage_buffer *src, int rx, int ry, int rw, int rh);
 
 bool simage_dupe(simage_buffer *src, simage_buffer *dst);
 bool simage_resized(simage_buffer *src, int nw, int nh, simage_buffer *dst);
+
+typedef enum simage_filter {
+    SIMAGE_FILTER_NEAREST,
+    SIMAGE_FILTER_BILINEAR,
+    SIMAGE_FILTER_BICUBIC,
+    SIMAGE_FILTER_MITCHELL,
+    SIMAGE_FILTER_LANCZOS3,
+    SIMAGE_FILTER_BOX,
+    SIMAGE_FILTER_KAISER,
+    SIMAGE_FILTER_AREA // Exact area average, falls back to BOX when enlarging
+} simage_filter;
+
+bool simage_resized_ex(simage_buffer *src, int nw, int nh, simage_filter filter, simage_buffer *dst);
+/* Fills out_levels (SG_MAX_MIPMAPS buffers) with src followed by successive half size levels down
+   to 1x1, returning the number of levels. SIMAGE_FILTER_BOX uses a dedicated 2x2 kernel, other
+   filters go through simage_resized_ex. gamma_correct filters in linear light */
+int simage_build_mips(simage_buffer *src, simage_filter filter, bool gamma_correct, simage_buffer *out_levels);
 bool simage_rotated(simage_buffer *src, float angle, simage_buffer *dst);
+/* Rotates clockwise around the image center, growing the result to fit. Supports NEAREST,
+   BILINEAR and BICUBIC, the other filters map to the closest of those */
+bool simage_rotated_ex(simage_buffer *src, float angle, simage_filter filter, simage_buffer *dst);
+/* Same result as simage_rotated_ex with BILINEAR, but done as three streaming 1-D shears.
+   Uses more memory, scales much better on images far larger than the caches */
+bool simage_rotated_shear(simage_buffer *src, float angle, simage_buffer *dst);
+
+typedef enum simage_edge_mode {
+    SIMAGE_EDGE_NONE, // Pixels mapping outside the source stay transparent
+    SIMAGE_EDGE_CLAMP,
+    SIMAGE_EDGE_WRAP
+} simage_edge_mode;
+
+/* Creates a dw x dh image from src transformed by m, which maps source to destination positions
+   (row-major 2x3 affine or 3x3 homography). Filters are as for simage_rotated_ex. Returns false
+   if m is not invertible */
+bool simage_warp_affine(simage_buffer *src, const float m[6], int dw, int dh, simage_filter filter, simage_edge_mode edge, simage_buffer *dst);
+bool simage_warp_perspective(simage_buffer *src, const float m[9], int dw, int dh, simage_filter filter, simage_edge_mode edge, simage_buffer *dst);
+/* Exact clockwise quarter turns and mirroring. simage_rotated dispatches to these for multiples
+   of 90 degrees, 180 and the flips work in place without allocating */
+bool simage_rotated90(simage_buffer *src, simage_buffer *dst);
+bool simage_rotated180(simage_buffer *src, simage_buffer *dst);
+bool simage_rotated270(simage_buffer *src, simage_buffer *dst);
+void simage_rotate90(simage_buffer *img);
+void simage_rotate180(simage_buffer *img);
+void simage_rotate270(simage_buffer *img);
+void simage_flip_h(simage_buffer *img);
+void simage_flip_v(simage_buffer *img);
 bool simage_clipped(simage_buffer *src, int rx, int ry, int rw, int rh, simage_buffer *dst);
 
+/* Out-of-core image for inputs too large to fit in memory. Pixels live in square tiles that are
+   paged to and from a scratch file, at most `budget` bytes of tiles are kept resident (LRU).
+   tile_size, budget and scratch_path may be 0/NULL for defaults (256, 256MB, tmpfile()) */
+typedef struct simage_virtual {
+    unsigned int width, height;
+    void *pager;
+} simage_virtual;
+
+bool simage_virtual_empty(unsigned int w, unsigned int h, sg_color color, unsigned int tile_size, size_t budget, const char *scratch_path, simage_virtual *dst);
+void simage_virtual_destroy(simage_virtual *img);
+/* pset and paste return false when a tile couldn't be paged to or from the scratch file, the
+   affected pixels are lost. pget reads such pixels as transparent black */
+bool simage_virtual_pset(simage_virtual *img, int x, int y, sg_color color);
+sg_color simage_virtual_pget(simage_virtual *img, int x, int y);
+bool simage_virtual_paste(simage_virtual *dst, simage_buffer *src, int x, int y);
+bool simage_virtual_clipped(simage_virtual *src, int rx, int ry, int rw, int rh, simage_buffer *dst);
+bool simage_virtual_resized(simage_virtual *src, int nw, int nh, simage_buffer *dst);
+/* Drawing straight into the tiles, with the same pixels the simage_buffer versions produce.
+   Like pset they return false when a tile couldn't be paged */
+bool simage_virtual_draw_line(simage_virtual *img, int x0, int y0, int x1, int y1, sg_color color);
+bool simage_virtual_draw_rectangle(simage_virtual *img, int x, int y, int w, int h, sg_color color, int fill);
+bool simage_virtual_blend(simage_virtual *dst, simage_buffer *src, int x, int y, simage_blend_mode mode);
+
 void simage_draw_line(simage_buffer *img, int x0, int y0, int x1, int y1, sg_color color);
 void simage_draw_circle(simage_buffer *img, int xc, int yc, int r, sg_color color, int fill);
 void simage_draw_rectangle(simage_buffer *img, int x, int y, int w, int h, sg_color color, int fill);
+/* Filled triangles cover the pixels whose centers lie inside, those on an edge only when it is a
+   top or left edge, so meshes sharing edges draw every pixel once. Unlike the outline, a fill
+   leaves out pixels on its right and bottom edges and draws nothing for collinear vertices */
 void simage_draw_triangle(simage_buffer *img, int x0, int y0, int x1, int y1, int x2, int y2, sg_color color, int fill);
+/* Anti-aliased variants, blended over the image. Coordinates are sub-pixel with integer values
+   at pixel centers, outlines are one pixel wide */
+void simage_draw_line_aa(simage_buffer *img, float x0, float y0, float x1, float y1, sg_color color);
+void simage_draw_circle_aa(simage_buffer *img, float xc, float yc, float r, sg_color color, int fill);
+void simage_draw_ellipse_aa(simage_buffer *img, float xc, float yc, float rx, float ry, sg_color color, int fill);
+
+typedef enum simage_fill_rule {
+    SIMAGE_FILL_EVEN_ODD,
+    SIMAGE_FILL_NON_ZERO
+} simage_fill_rule;
+
+/* points holds n x/y pairs, the polygon is closed implicitly and may self intersect */
+void simage_fill_polygon(simage_buffer *img, const float *points, int n, simage_fill_rule rule, sg_color color);
+void simage_fill_polygon_aa(simage_buffer *img, const float *points, int n, simage_fill_rule rule, sg_color color);
+
+/* Vertex of the 3D triangle fills. x/y are screen positions with integer values at pixel centers,
+   z is the depth (0 near, 1 far) and w the clip space w before the perspective divide, 1 for flat
+   geometry. Colors and u/v (0..1 across the texture) are interpolated perspective correct.
+   Triangles must be clipped to the near plane beforehand, those with a vertex at w <= 0 are skipped */
+typedef struct simage_vertex {
+    float x, y, z, w;
+    float u, v;
+    sg_color color;
+} simage_vertex;
+
+/* 16 bit normalized or 32 bit float depths. Pixels are only drawn where they are closer than
+   the stored depth, which they then replace. simage_depth_empty clears to 1 */
+typedef struct simage_depth {
+    unsigned int width, height;
+    int bits;
+    void *buffer;
+} simage_depth;
+
+bool simage_depth_empty(unsigned int w, unsigned int h, int bits, simage_depth *dst);
+void simage_depth_clear(simage_depth *depth, float value);
+void simage_depth_destroy(simage_depth *depth);
+/* Gouraud shaded and textured triangles, depth may be NULL. Textures are multiplied by the
+   vertex colors and fully transparent texels are discarded. NEAREST and BILINEAR are supported,
+   other filters sample bilinear. Large triangles are split across threads */
+void simage_draw_triangle_shaded(simage_buffer *img, simage_depth *depth, const simage_vertex vertices[3]);
+void simage_draw_triangle_textured(simage_buffer *img, simage_depth *depth, const simage_vertex vertices[3], simage_buffer *texture, simage_filter filter, simage_edge_mode edge);
+
+/* Records draw calls and blits against target instead of running them. simage_canvas_flush bins
+   the recorded commands into SIMAGE_BLIT_TILE tiles and rasterizes the tiles across threads, each
+   tile replaying its commands in submission order, so the result matches drawing immediately.
+   Recording returns false when out of memory, blit sources must stay alive until the flush */
+typedef struct simage_canvas {
+    simage_buffer *target;
+    void *commands;
+    size_t count, capacity;
+    float *points;
+    size_t point_count, point_capacity;
+} simage_canvas;
+
+void simage_canvas_init(simage_canvas *canvas, simage_buffer *target);
+void simage_canvas_destroy(simage_canvas *canvas);
+bool simage_canvas_line(simage_canvas *canvas, int x0, int y0, int x1, int y1, sg_color color);
+bool simage_canvas_circle(simage_canvas *canvas, int xc, int yc, int r, sg_color color, int fill);
+bool simage_canvas_rectangle(simage_canvas *canvas, int x, int y, int w, int h, sg_color color, int fill);
+bool simage_canvas_triangle(simage_canvas *canvas, int x0, int y0, int x1, int y1, int x2, int y2, sg_color color, int fill);
+bool simage_canvas_line_aa(simage_canvas *canvas, float x0, float y0, float x1, float y1, sg_color color);
+bool simage_canvas_circle_aa(simage_canvas *canvas, float xc, float yc, float r, sg_color color, int fill);
+bool simage_canvas_ellipse_aa(simage_canvas *canvas, float xc, float yc, float rx, float ry, sg_color color, int fill);
+bool simage_canvas_polygon(simage_canvas *canvas, const float *points, int n, simage_fill_rule rule, sg_color color, bool aa);
+bool simage_canvas_blit(simage_canvas *canvas, const simage_blit_cmd *blit);
+bool simage_canvas_triangle_shaded(simage_canvas *canvas, simage_depth *depth, const simage_vertex vertices[3]);
+bool simage_canvas_triangle_textured(simage_canvas *canvas, simage_depth *depth, const simage_vertex vertices[3], simage_buffer *texture, simage_filter filter, simage_edge_mode edge);
+// Executes and clears the recorded commands
+void simage_canvas_flush(simage_canvas *canvas);
+
+/* Glyph of a font atlas. x/y/w/h is its rectangle in the atlas, xoff/yoff the offset of that
+   rectangle's top-left corner from the pen position on the baseline */
+typedef struct simage_glyph {
+    uint32_t codepoint;
+    int x, y, w, h;
+    int xoff, yoff;
+    float advance;
+} simage_glyph;
+
+typedef struct simage_kerning {
+    uint32_t first, second;
+    float amount;
+} simage_kerning;
+
+/* Glyph atlas cache. Coverage comes from the atlas alpha, text is drawn in a single color. With
+   sdf_spread set the alpha holds a signed distance field instead (128 on the outline) reaching
+   sdf_spread atlas pixels to either side, which stays sharp at any scale. TrueType fonts bake
+   glyphs into the atlas the first time they are drawn, so drawing with them is not thread safe */
+typedef struct simage_font {
+    simage_buffer atlas;
+    float ascent, line_height, sdf_spread;
+    simage_glyph *glyphs;
+    size_t glyph_count, glyph_capacity;
+    uint32_t *index;
+    size_t index_capacity;
+    simage_kerning *kerning;
+    size_t kerning_count, kerning_capacity;
+    int pack_x, pack_y, pack_h;
+    void *ttf;
+    float ttf_scale;
+} simage_font;
+
+/* Monospace font image loaded with simage_load_from_path, cells are read left to right and top
+   to bottom as consecutive codepoints starting at first. sdf_spread is 0 for plain coverage */
+bool simage_font_load_grid(const char *path, int cell_w, int cell_h, uint32_t first, float sdf_spread, simage_font *dst);
+// Pre-baked atlas with its glyph metrics (e.g. from a BMFont description), atlas is copied
+bool simage_font_from_atlas(simage_buffer *atlas, const simage_glyph *glyphs, size_t n, float ascent, float line_height, float sdf_spread, simage_font *dst);
+/* Glyphs rasterized at pixel_height on demand from the font's TrueType outlines, as distance
+   fields when sdf_spread > 0. Kerning comes from the 'kern' table, CFF (.otf) outlines are not
+   supported. data must stay alive as long as the font and is trusted to be well-formed */
+bool simage_font_from_ttf(const void *data, float pixel_height, float sdf_spread, simage_font *dst);
+bool simage_font_add_kerning(simage_font *font, uint32_t first, uint32_t second, float amount);
+void simage_font_destroy(simage_font *font);
+/* UTF-8 text with the top-left of its first line at x/y, '\n' starts a new line. Scaled glyphs
+   are sampled bilinear */
+void simage_draw_text(simage_buffer *img, simage_font *font, float x, float y, const char *text, float scale, sg_color color);
+void simage_measure_text(simage_font *font, const char *text, float scale, float *w, float *h);
 
 /* These functions were adapted from https://github.com/mattiasgustavsson/libs/blob/main/img.h
    Copyright Mattias Gustavsson (C) 2019 [MIT/Public Domain] */
@@ -88,6 +360,7 @@ sg_image sg_empty_texture(unsigned int width, unsigned int height);
 sg_image sg_load_texture_path(const char *path, unsigned int *width, unsigned int *height);
 sg_image sg_load_texture_from_memory(unsigned char *data, size_t data_size, unsigned int *width, unsigned int *height);
 sg_image sg_load_texture_from_buffer(simage_buffer *img);
+sg_image sg_load_texture_from_buffer_mipmapped(simage_buffer *img, simage_filter filter, bool gamma_correct);
 void sg_update_texture_from_buffer(sg_image texture, simage_buffer *img);
 
 #if defined(__cplusplus)
@@ -104,6 +377,45 @@ void sg_update_texture_from_buffer(sg_image texture, simage_buffer *img);
 #else
 #include <unistd.h>
 #endif
+#include <limits.h>
+
+#ifndef SIMAGE_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMAGE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define SIMAGE_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMAGE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#ifndef SIMAGE_NO_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+#ifndef SIMAGE_MAX_THREADS
+#define SIMAGE_MAX_THREADS 64
+#endif
+// Minimum number of pixels of work given to each thread
+#ifndef SIMAGE_PARALLEL_THRESHOLD
+#define SIMAGE_PARALLEL_THRESHOLD (256 * 1024)
+#endif
+// Destination tile size used to bin simage_blit_batch and simage_canvas commands
+#ifndef SIMAGE_BLIT_TILE
+#define SIMAGE_BLIT_TILE 128
+#endif
+// Fills larger than this (in bytes) bypass the cache with non-temporal stores
+#ifndef SIMAGE_STREAM_THRESHOLD
+#define SIMAGE_STREAM_THRESHOLD (8 * 1024 * 1024)
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 /* stb_image - v2.27 - public domain image loader - http://nothings.org/stb
@@ -10384,6 +10696,21 @@ void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
 #define _RGBA(R, G, B, A) (((unsigned int)(R) << 24) | ((unsigned int)(B) << 16) | ((unsigned int)(G) << 8) | (A))
 #define _F2I(F) (int)((F) * 255.f)
 #define _I2F(I) (float)((float)(I) / 255.f)
+#ifndef _MIN
+#define _MIN(A, B) ((A) < (B) ? (A) : (B))
+#endif
+#ifndef _MAX
+#define _MAX(A, B) ((A) > (B) ? (A) : (B))
+#endif
+#ifndef _CLAMP
+#define _CLAMP(V, LO, HI) (_MIN(_MAX((V), (LO)), (HI)))
+#endif
+#ifndef _SWAP
+#define _SWAP(A, B) do { int _t = (A); (A) = (B); (B) = _t; } while (0)
+#endif
+#ifndef _RADIANS
+#define _RADIANS(D) ((D) * 0.0174532925f)
+#endif
 
 static uint32_t sg_color_to_int(sg_color color) {
     return _RGBA(_F2I(color.r), _F2I(color.g), _F2I(color.b), _F2I(color.a));
@@ -10392,18 +10719,263 @@ static uint32_t sg_color_to_int(sg_color color) {
 static sg_color int_to_sg_color(int32_t color) {
     return (sg_color) {
         .r = _I2F((color >> 24) & 0xFF),
-        .g = _I2F((color >> 16) & 0xFF),
-        .b = _I2F((color >> 8) & 0xFF),
+        .g = _I2F((color >> 8) & 0xFF),
+        .b = _I2F((color >> 16) & 0xFF),
         .a = _I2F(color & 0xFF)
     };
 }
 
-bool simage_empty(unsigned int w, unsigned int h, sg_color color, simage_buffer *dst) {
+typedef void(*job_fn)(void *userdata, int begin, int end);
+
+static int thread_count = 0;
+
+void simage_set_thread_count(int count) {
+    thread_count = _CLAMP(count, 0, SIMAGE_MAX_THREADS);
+}
+
+int simage_thread_count(void) {
+#ifdef SIMAGE_NO_THREADS
+    return 1;
+#else
+    if (thread_count)
+        return thread_count;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int cores = (int)info.dwNumberOfProcessors;
+#else
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return _CLAMP(cores, 1, SIMAGE_MAX_THREADS);
+#endif
+}
+
+// Chunks handed out per participating thread, more balance uneven work better
+#define _PARALLEL_CHUNKS 16
+
+#ifndef SIMAGE_NO_THREADS
+/* Persistent worker pool. parallel_for publishes a batch, then the caller and up to `helpers`
+   workers claim chunks of it through an atomic counter until none are left. Batches of
+   concurrent or nested calls queue up together, and as the caller works through its own batch
+   it never waits on a busy pool, only on chunks other threads already started */
+typedef struct pool_batch {
+    job_fn fn;
+    void *userdata;
+    int count, chunks, helpers, joined, active;
+    volatile long next;
+    struct pool_batch *link;
+} pool_batch_t;
+
+static pool_batch_t *pool_queue = NULL;
+static int pool_workers = 0;
+#ifdef _WIN32
+static SRWLOCK pool_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE pool_wake = CONDITION_VARIABLE_INIT, pool_done = CONDITION_VARIABLE_INIT;
+#define _POOL_LOCK() AcquireSRWLockExclusive(&pool_lock)
+#define _POOL_UNLOCK() ReleaseSRWLockExclusive(&pool_lock)
+#define _POOL_WAIT(C) SleepConditionVariableSRW(&(C), &pool_lock, INFINITE, 0)
+#define _POOL_BROADCAST(C) WakeAllConditionVariable(&(C))
+#define _POOL_CLAIM(B) ((int)InterlockedExchangeAdd(&(B)->next, 1))
+#define _POOL_CLAIMED(B) ((int)InterlockedCompareExchange(&(B)->next, 0, 0))
+#else
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER, pool_done = PTHREAD_COND_INITIALIZER;
+#define _POOL_LOCK() pthread_mutex_lock(&pool_lock)
+#define _POOL_UNLOCK() pthread_mutex_unlock(&pool_lock)
+#define _POOL_WAIT(C) pthread_cond_wait(&(C), &pool_lock)
+#define _POOL_BROADCAST(C) pthread_cond_broadcast(&(C))
+#define _POOL_CLAIM(B) ((int)__atomic_fetch_add(&(B)->next, 1, __ATOMIC_RELAXED))
+#define _POOL_CLAIMED(B) ((int)__atomic_load_n(&(B)->next, __ATOMIC_RELAXED))
+#endif
+
+static void pool_run(pool_batch_t *batch) {
+    for (int i; (i = _POOL_CLAIM(batch)) < batch->chunks;)
+        batch->fn(batch->userdata, (int)((int64_t)batch->count * i / batch->chunks), (int)((int64_t)batch->count * (i + 1) / batch->chunks));
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_worker(LPVOID arg) {
+#else
+static void* pool_worker(void *arg) {
+#endif
+    (void)arg;
+    _POOL_LOCK();
+    for (;;) {
+        pool_batch_t *batch = pool_queue;
+        while (batch && (batch->joined >= batch->helpers || _POOL_CLAIMED(batch) >= batch->chunks))
+            batch = batch->link;
+        if (!batch) {
+            _POOL_WAIT(pool_wake);
+            continue;
+        }
+        batch->joined++;
+        batch->active++;
+        _POOL_UNLOCK();
+        pool_run(batch);
+        _POOL_LOCK();
+        if (!--batch->active)
+            _POOL_BROADCAST(pool_done);
+    }
+    return 0;
+}
+
+// Called with the lock held, workers are started on demand and never exit
+static void pool_grow(int workers) {
+    for (; pool_workers < workers; pool_workers++) {
+#ifdef _WIN32
+        HANDLE thread = CreateThread(NULL, 0, pool_worker, NULL, 0, NULL);
+        if (!thread)
+            break;
+        CloseHandle(thread);
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, NULL))
+            break;
+        pthread_detach(thread);
+#endif
+    }
+}
+#endif
+
+// Run [0, count) across the worker pool in chunks, work is the total number of pixels touched
+// and decides how many threads are worth involving
+static void parallel_for(int count, size_t work, job_fn fn, void *userdata) {
+    int n = (int)_MIN((size_t)simage_thread_count(), work / SIMAGE_PARALLEL_THRESHOLD);
+    n = _MIN(n, count);
+    if (n <= 1) {
+        if (count > 0)
+            fn(userdata, 0, count);
+        return;
+    }
+#ifndef SIMAGE_NO_THREADS
+    pool_batch_t batch = {
+        .fn = fn,
+        .userdata = userdata,
+        .count = count,
+        .chunks = (int)_MIN((int64_t)count, (int64_t)n * _PARALLEL_CHUNKS),
+        .helpers = n - 1
+    };
+    _POOL_LOCK();
+    pool_grow(n - 1);
+    batch.link = pool_queue;
+    pool_queue = &batch;
+    _POOL_BROADCAST(pool_wake);
+    _POOL_UNLOCK();
+    pool_run(&batch);
+    _POOL_LOCK();
+    pool_batch_t **link = &pool_queue;
+    while (*link != &batch)
+        link = &(*link)->link;
+    *link = batch.link;
+    while (batch.active)
+        _POOL_WAIT(pool_done);
+    _POOL_UNLOCK();
+#endif
+}
+
+static void fill_row(uint32_t *p, size_t n, uint32_t color, bool stream) {
+    // Only the x86 paths have non-temporal stores
+    (void)stream;
+#if defined(SIMAGE_SSE2) || defined(SIMAGE_NEON)
+    for (; n && ((uintptr_t)p & 15); n--)
+        *p++ = color;
+#if defined(SIMAGE_AVX2)
+    if (n >= 8 && ((uintptr_t)p & 31)) {
+        _mm_store_si128((__m128i*)p, _mm_set1_epi32((int)color));
+        p += 4;
+        n -= 4;
+    }
+    __m256i v = _mm256_set1_epi32((int)color);
+    if (stream)
+        for (; n >= 32; n -= 32, p += 32) {
+            _mm256_stream_si256((__m256i*)p, v);
+            _mm256_stream_si256((__m256i*)(p + 8), v);
+            _mm256_stream_si256((__m256i*)(p + 16), v);
+            _mm256_stream_si256((__m256i*)(p + 24), v);
+        }
+    for (; n >= 8; n -= 8, p += 8)
+        _mm256_store_si256((__m256i*)p, v);
+#elif defined(SIMAGE_SSE2)
+    __m128i v = _mm_set1_epi32((int)color);
+    if (stream)
+        for (; n >= 16; n -= 16, p += 16) {
+            _mm_stream_si128((__m128i*)p, v);
+            _mm_stream_si128((__m128i*)(p + 4), v);
+            _mm_stream_si128((__m128i*)(p + 8), v);
+            _mm_stream_si128((__m128i*)(p + 12), v);
+        }
+    for (; n >= 16; n -= 16, p += 16) {
+        _mm_store_si128((__m128i*)p, v);
+        _mm_store_si128((__m128i*)(p + 4), v);
+        _mm_store_si128((__m128i*)(p + 8), v);
+        _mm_store_si128((__m128i*)(p + 12), v);
+    }
+    for (; n >= 4; n -= 4, p += 4)
+        _mm_store_si128((__m128i*)p, v);
+#else
+    uint32x4_t v = vdupq_n_u32(color);
+    for (; n >= 16; n -= 16, p += 16) {
+        vst1q_u32(p, v);
+        vst1q_u32(p + 4, v);
+        vst1q_u32(p + 8, v);
+        vst1q_u32(p + 12, v);
+    }
+    for (; n >= 4; n -= 4, p += 4)
+        vst1q_u32(p, v);
+#endif
+#endif
+    while (n--)
+        *p++ = color;
+}
+
+typedef struct fill_job {
+    uint32_t *buffer;
+    size_t stride, width;
+    uint32_t color;
+    bool stream;
+} fill_job_t;
+
+static void fill_rows(void *userdata, int begin, int end) {
+    fill_job_t *job = (fill_job_t*)userdata;
+    if (job->stride == job->width)
+        fill_row(job->buffer + begin * job->stride, (size_t)(end - begin) * job->width, job->color, job->stream);
+    else
+        for (int y = begin; y < end; y++)
+            fill_row(job->buffer + y * job->stride, job->width, job->color, job->stream);
+#if defined(SIMAGE_SSE2)
+    if (job->stream)
+        _mm_sfence();
+#endif
+}
+
+static void fill_rect(simage_buffer *img, int x, int y, int w, int h, uint32_t color) {
+    int x0 = _MAX(x, 0), y0 = _MAX(y, 0);
+    int x1 = (int)_MIN((int64_t)x + w, (int64_t)img->width);
+    int y1 = (int)_MIN((int64_t)y + h, (int64_t)img->height);
+    if (!img->buffer || x0 >= x1 || y0 >= y1)
+        return;
+    size_t pixels = (size_t)(x1 - x0) * (y1 - y0);
+    fill_job_t job = {
+        .buffer = simage_row_ptr(img, y0) + x0,
+        .stride = img->width,
+        .width = x1 - x0,
+        .color = color,
+        .stream = pixels * sizeof(uint32_t) >= SIMAGE_STREAM_THRESHOLD
+    };
+    parallel_for(y1 - y0, pixels, fill_rows, &job);
+}
+
+// For results that overwrite every pixel anyway
+static bool alloc_buffer(unsigned int w, unsigned int h, simage_buffer *dst) {
     if (w <= 0 || h <= 0)
         return false;
     dst->width = w;
     dst->height = h;
-    if (!(dst->buffer = (int32_t*)malloc(w * h * sizeof(int32_t))))
+    return (dst->buffer = (int32_t*)malloc((size_t)w * h * sizeof(int32_t))) != NULL;
+}
+
+bool simage_empty(unsigned int w, unsigned int h, sg_color color, simage_buffer *dst) {
+    if (!alloc_buffer(w, h, dst))
         return false;
     simage_fill(dst, color);
     return true;
@@ -10460,14 +11032,14 @@ bool simage_load_from_memory(const void *data, size_t data_size, simage_buffer *
 
     dst->width = _w;
     dst->height = _h;
-    if (!(dst->buffer = malloc(_w * _h * sizeof(int)))) {
+    if (!(dst->buffer = malloc((size_t)_w * _h * sizeof(int)))) {
         free(img_data);
         return false;
     }
     for (int x = 0; x < _w; x++)
         for (int y = 0; y < _h; y++) {
-            unsigned char *p = img_data + (x + _w * y) * 4;
-            dst->buffer[y * _w + x] = _RGBA(p[0], p[1], p[2], p[3]);
+            unsigned char *p = img_data + ((size_t)_w * y + x) * 4;
+            dst->buffer[(size_t)y * _w + x] = _RGBA(p[0], p[1], p[2], p[3]);
         }
     free(img_data);
     return true;
@@ -10480,357 +11052,5100 @@ void simage_destroy_buffer(simage_buffer *img) {
     }
 }
 
-void simage_pset(simage_buffer *img, int x, int y, sg_color color) {
-    if (img->buffer && x >= 0 && y >= 0 && x <= img->width && y <= img->height)
-        img->buffer[y * img->width + x] = sg_color_to_int(color);
+uint32_t simage_pack_color(sg_color color) {
+    return sg_color_to_int(color);
 }
 
-sg_color simage_pget(simage_buffer *img, int x, int y) {
-    int32_t color = 0;
-    if (img->buffer && x >= 0 && y >= 0 && x <= img->width && y <= img->height)
-        color = img->buffer[y * img->width + x];
+sg_color simage_unpack_color(uint32_t color) {
     return int_to_sg_color(color);
 }
 
-void simage_fill(simage_buffer *img, sg_color color) {
-    for (int i = 0; i < img->width * img->height; ++i)
-        img->buffer[i] = sg_color_to_int(color);
-}
-
-void _pset(simage_buffer *img, int x, int y, int32_t color) {
-    if (img->buffer && x >= 0 && y >= 0 && x <= img->width && y <= img->height)
-        img->buffer[y * img->width + x] = color;
+void simage_pset_u32(simage_buffer *img, int x, int y, uint32_t color) {
+    if (img->buffer && x >= 0 && y >= 0 && (unsigned int)x < img->width && (unsigned int)y < img->height)
+        img->buffer[(size_t)y * img->width + x] = color;
 }
 
-int32_t _pget(simage_buffer *img, int x, int y) {
-    int32_t color = 0;
-    if (img->buffer && x >= 0 && y >= 0 && x <= img->width && y <= img->height)
-        color = img->buffer[y * img->width + x];
+uint32_t simage_pget_u32(simage_buffer *img, int x, int y) {
+    uint32_t color = 0;
+    if (img->buffer && x >= 0 && y >= 0 && (unsigned int)x < img->width && (unsigned int)y < img->height)
+        color = img->buffer[(size_t)y * img->width + x];
     return color;
 }
 
-static inline void flood_fn(simage_buffer *img, int x, int y, int _new, int _old) {
-    if (_new == _old || _pget(img, x, y) != _old)
+void simage_set_span(simage_buffer *img, int x, int y, int n, uint32_t color) {
+    if (!img->buffer || y < 0 || (unsigned int)y >= img->height)
         return;
-
-    int x1 = x;
-    while (x1 < img->width && _pget(img, x1, y) == _old) {
-        _pset(img, x1, y, _new);
-        x1++;
+    if (x < 0) {
+        n += x;
+        x = 0;
     }
+    if (n > (int)img->width - x)
+        n = img->width - x;
+    if (n > 0)
+        fill_row(simage_row_ptr(img, y) + x, n, color, false);
+}
 
-    x1 = x - 1;
-    while (x1 >= 0 && _pget(img, x1, y) == _old) {
-        _pset(img, x1, y, _new);
-        x1--;
-    }
+uint32_t* simage_row_ptr(simage_buffer *img, int y) {
+    return (uint32_t*)img->buffer + (size_t)y * img->width;
+}
 
-    x1 = x;
-    while (x1 < img->width && _pget(img, x1, y) == _old) {
-        if(y > 0 && _pget(img, x1, y - 1) == _old)
-            flood_fn(img, x1, y - 1, _new, _old);
-        x1++;
-    }
+void simage_pset(simage_buffer *img, int x, int y, sg_color color) {
+    simage_pset_u32(img, x, y, sg_color_to_int(color));
+}
 
-    x1 = x - 1;
-    while(x1 >= 0 && _pget(img, x1, y) == _old) {
-        if(y > 0 && _pget(img, x1, y - 1) == _old)
-            flood_fn(img, x1, y - 1, _new, _old);
-        x1--;
-    }
+sg_color simage_pget(simage_buffer *img, int x, int y) {
+    return int_to_sg_color(simage_pget_u32(img, x, y));
+}
 
-    x1 = x;
-    while(x1 < img->width && _pget(img, x1, y) == _old) {
-        if(y < img->height - 1 && _pget(img, x1, y + 1) == _old)
-            flood_fn(img, x1, y + 1, _new, _old);
-        x1++;
-    }
+void simage_fill(simage_buffer *img, sg_color color) {
+    fill_rect(img, 0, 0, img->width, img->height, sg_color_to_int(color));
+}
 
-    x1 = x - 1;
-    while(x1 >= 0 && _pget(img, x1, y) == _old) {
-        if(y < img->height - 1 && _pget(img, x1, y + 1) == _old)
-            flood_fn(img, x1, y + 1, _new, _old);
-        x1--;
-    }
+void simage_fill_rect(simage_buffer *img, int x, int y, int w, int h, sg_color color) {
+    fill_rect(img, x, y, w, h, sg_color_to_int(color));
 }
 
-void simage_flood(simage_buffer *img, int x, int y, sg_color color) {
-    if (x < 0 || y < 0 || x >= img->width || y >= img->height)
-        return;
-    flood_fn(img, x, y, sg_color_to_int(color), _pget(img, x, y));
+static inline bool color_near(uint32_t a, uint32_t b, int tolerance) {
+    if (a == b)
+        return true;
+    for (int i = 0; i < 32; i += 8)
+        if (abs((int)((a >> i) & 0xFF) - (int)((b >> i) & 0xFF)) > tolerance)
+            return false;
+    return true;
 }
 
-void simage_paste(simage_buffer *dst, simage_buffer *src, int x, int y) {
-    for (int ox = 0; ox < src->width; ++ox) {
-        for (int oy = 0; oy < src->height; ++oy) {
-            if (oy > dst->height)
-                break;
-            simage_pset(dst, x + ox, y + oy, simage_pget(src, ox, oy));
-        }
-        if (ox > dst->width)
-            break;
-    }
+typedef struct flood_span {
+    int y, xl, xr, dy;
+} flood_span_t;
+
+typedef struct flood {
+    simage_buffer *img;
+    uint32_t seed, color;
+    int tolerance;
+    bool exact;
+    unsigned char *mask, *visited;
+    int x0, y0, x1, y1;
+    flood_span_t *stack;
+    size_t count, capacity;
+} flood_t;
+
+static inline bool flood_inside(flood_t *f, int x, int y) {
+    size_t i = (size_t)y * f->img->width + x;
+    if (f->mask ? f->mask[i] : f->visited ? (f->visited[i >> 3] >> (i & 7)) & 1 : false)
+        return false;
+    return color_near(f->img->buffer[i], f->seed, f->tolerance);
 }
 
-void simage_clipped_paste(simage_buffer *dst, simage_buffer *src, int x, int y, int rx, int ry, int rw, int rh) {
-    for (int ox = 0; ox < rw; ++ox)
-        for (int oy = 0; oy < rh; ++oy)
-            simage_pset(dst, ox + x, oy + y, simage_pget(src, ox + rx, oy + ry));
+// Step from x towards end (exclusive) while flood_inside() == want
+static inline int flood_scan(flood_t *f, int x, int y, int end, int step, bool want) {
+    if (f->exact) {
+        const uint32_t *row = simage_row_ptr(f->img, y);
+        while (x != end && (row[x] == f->seed) == want)
+            x += step;
+    } else
+        while (x != end && flood_inside(f, x, y) == want)
+            x += step;
+    return x;
 }
 
-bool simage_dupe(simage_buffer *src, simage_buffer *dst) {
-    if (!simage_empty(src->width, src->height, sg_black, dst))
-        return false;
-    memcpy(dst->buffer, src->buffer, src->width * src->height * sizeof(uint32_t));
+static inline void flood_set(flood_t *f, int y, int xl, int xr) {
+    if (xl > xr)
+        return;
+    size_t i = (size_t)y * f->img->width + xl, n = xr - xl + 1;
+    if (f->mask) {
+        memset(f->mask + i, 255, n);
+        return;
+    }
+    fill_row((uint32_t*)f->img->buffer + i, n, f->color, false);
+    if (f->visited) {
+        for (; n && (i & 7); n--, i++)
+            f->visited[i >> 3] |= 1 << (i & 7);
+        memset(f->visited + (i >> 3), 0xFF, n >> 3);
+        for (i += n & ~(size_t)7, n &= 7; n; n--, i++)
+            f->visited[i >> 3] |= 1 << (i & 7);
+    }
+}
+
+static inline bool flood_push(flood_t *f, int y, int xl, int xr, int dy) {
+    if (y + dy < f->y0 || y + dy > f->y1)
+        return true;
+    if (f->count == f->capacity) {
+        size_t capacity = f->capacity ? f->capacity * 2 : 256;
+        flood_span_t *stack = realloc(f->stack, capacity * sizeof(flood_span_t));
+        if (!stack)
+            return false;
+        f->stack = stack;
+        f->capacity = capacity;
+    }
+    f->stack[f->count++] = (flood_span_t){y, xl, xr, dy};
     return true;
 }
 
-bool simage_resized(simage_buffer *src, int nw, int nh, simage_buffer *dst) {
-    if (!simage_empty(nw, nh, sg_black, dst))
+/* Span based seed fill, see Paul Heckbert, "A Seed Fill Algorithm", Graphics Gems (1990) */
+static bool flood_fn(flood_t *f, int x, int y, bool eight) {
+    bool ok = flood_push(f, y, x, x, 1) && flood_push(f, y + 1, x, x, -1);
+    while (ok && f->count) {
+        flood_span_t s = f->stack[--f->count];
+        int x1 = s.xl, x2 = s.xr, dy = s.dy, l, start;
+        y = s.y + dy;
+        // Diagonal neighbours widen the parent span, leaks are still measured against the original
+        if (eight) {
+            x1 = _MAX(x1 - 1, f->x0);
+            x2 = _MIN(x2 + 1, f->x1);
+        }
+        x = flood_scan(f, x1, y, f->x0 - 1, -1, true);
+        flood_set(f, y, x + 1, x1);
+        if (x >= x1)
+            goto SKIP;
+        l = x + 1;
+        if (l < s.xl)
+            ok = ok && flood_push(f, y, l, s.xl - 1, -dy);
+        x = x1 + 1;
+        do {
+            start = x;
+            x = flood_scan(f, x, y, f->x1 + 1, 1, true);
+            flood_set(f, y, start, x - 1);
+            ok = ok && flood_push(f, y, l, x - 1, dy);
+            if (x - 1 > s.xr)
+                ok = ok && flood_push(f, y, s.xr + 1, x - 1, -dy);
+        SKIP:
+            x = x + 1 > x2 ? x + 1 : flood_scan(f, x + 1, y, x2 + 1, 1, false);
+            l = x;
+        } while (x <= x2);
+    }
+    return ok;
+}
+
+bool simage_flood_ex(simage_buffer *img, int x, int y, sg_color color, const simage_flood_desc *desc) {
+    simage_flood_desc d = desc ? *desc : (simage_flood_desc){0};
+    flood_t f = {
+        .img = img,
+        .color = sg_color_to_int(color),
+        .tolerance = _MAX(d.tolerance, 0),
+        .mask = d.mask,
+        .x0 = _MAX(d.rx, 0),
+        .y0 = _MAX(d.ry, 0),
+        .x1 = d.rw > 0 ? (int)_MIN((int64_t)d.rx + d.rw, (int64_t)img->width) - 1 : (int)img->width - 1,
+        .y1 = d.rh > 0 ? (int)_MIN((int64_t)d.ry + d.rh, (int64_t)img->height) - 1 : (int)img->height - 1
+    };
+    if (!img->buffer || x < f.x0 || y < f.y0 || x > f.x1 || y > f.y1)
         return false;
-    int x_ratio = (int)((src->width << 16) / dst->width) + 1;
-    int y_ratio = (int)((src->height << 16) / dst->height) + 1;
-    int x2, y2, i, j;
-    for (i = 0; i < dst->height; ++i) {
-        int *t = dst->buffer + i * dst->width;
-        y2 = ((i * y_ratio) >> 16);
-        int *p = src->buffer + y2 * src->width;
-        int rat = 0;
-        for (j = 0; j < dst->width; ++j) {
-            x2 = (rat >> 16);
-            *t++ = p[x2];
-            rat += x_ratio;
+    f.seed = simage_pget_u32(img, x, y);
+    if (!f.mask) {
+        // Painting with a color the fill still matches needs explicit bookkeeping
+        if (color_near(f.color, f.seed, f.tolerance)) {
+            if (f.color == f.seed && !f.tolerance)
+                return true;
+            if (!(f.visited = calloc(((size_t)img->width * img->height + 7) / 8, 1)))
+                return false;
         }
     }
-    return true;
+    f.exact = !f.mask && !f.visited && !f.tolerance;
+    bool result = flood_fn(&f, x, y, d.eight_connected);
+    if (f.visited)
+        free(f.visited);
+    if (f.stack)
+        free(f.stack);
+    return result;
 }
 
-void simage_resize(simage_buffer *src, int nw, int nh) {
-    simage_buffer result;
-    if (!simage_resized(src, nw, nh, &result))
+void simage_flood(simage_buffer *img, int x, int y, sg_color color) {
+    simage_flood_ex(img, x, y, color, NULL);
+}
+
+/* Labels are pixel index + 1 of a parent pixel, parents always come earlier in raster order
+   so the root of every component is its first pixel */
+typedef struct label_job {
+    simage_buffer *img;
+    simage_label_desc desc;
+    uint32_t *labels;
+    unsigned char *strip_start;
+} label_job_t;
+
+static inline uint32_t label_find(uint32_t *labels, uint32_t l) {
+    while (labels[l - 1] != l)
+        l = labels[l - 1] = labels[labels[l - 1] - 1];
+    return l;
+}
+
+static inline uint32_t label_union(uint32_t *labels, uint32_t a, uint32_t b) {
+    a = label_find(labels, a);
+    b = label_find(labels, b);
+    if (a < b)
+        labels[b - 1] = a;
+    else
+        labels[a - 1] = b;
+    return _MIN(a, b);
+}
+
+static inline void label_join(label_job_t *job, size_t i, size_t j) {
+    uint32_t *buffer = (uint32_t*)job->img->buffer;
+    uint32_t a = job->labels[i], b = job->labels[j];
+    if (!b || a == b || !color_near(buffer[i], buffer[j], job->desc.tolerance))
         return;
-    free(src->buffer);
-    memcpy(src, &result, sizeof(simage_buffer));
+    job->labels[i] = a ? label_union(job->labels, a, b) : label_find(job->labels, b);
+}
+
+static void label_rows(void *userdata, int begin, int end) {
+    label_job_t *job = (label_job_t*)userdata;
+    size_t w = job->img->width;
+    job->strip_start[begin] = 1;
+    for (int y = begin; y < end; y++)
+        for (size_t x = 0; x < w; x++) {
+            size_t i = y * w + x;
+            job->labels[i] = 0;
+            if (job->desc.predicate && !job->desc.predicate(job->img->buffer[i], job->desc.userdata))
+                continue;
+            if (x > 0)
+                label_join(job, i, i - 1);
+            if (y > begin) {
+                if (job->desc.eight_connected && x > 0)
+                    label_join(job, i, i - w - 1);
+                label_join(job, i, i - w);
+                if (job->desc.eight_connected && x + 1 < w)
+                    label_join(job, i, i - w + 1);
+            }
+            if (!job->labels[i])
+                job->labels[i] = (uint32_t)i + 1;
+        }
 }
 
-bool simage_rotated(simage_buffer *src, float angle, simage_buffer *dst) {
-    float theta = _RADIANS(angle);
-    float c = cosf(theta), s = sinf(theta);
-    float r[3][2] = {
-        { -src->height * s, src->height * c },
-        {  src->width * c - src->height * s, src->height * c + src->width * s },
-        {  src->width * c, src->width * s }
+int simage_label_components(simage_buffer *img, const simage_label_desc *desc, uint32_t *labels, simage_component **stats) {
+    size_t w = img->width, h = img->height, n = 0, capacity = 0;
+    if (stats)
+        *stats = NULL;
+    if (!img->buffer || !labels || w * h >= UINT32_MAX)
+        return -1;
+    label_job_t job = {
+        .img = img,
+        .desc = desc ? *desc : (simage_label_desc){0},
+        .labels = labels
     };
-
-    float mm[2][2] = {{
-        _MIN(0, _MIN(r[0][0], _MIN(r[1][0], r[2][0]))),
-        _MIN(0, _MIN(r[0][1], _MIN(r[1][1], r[2][1])))
-    }, {
-        (theta > 1.5708  && theta < 3.14159 ? 0.f : _MAX(r[0][0], _MAX(r[1][0], r[2][0]))),
-        (theta > 3.14159 && theta < 4.71239 ? 0.f : _MAX(r[0][1], _MAX(r[1][1], r[2][1])))
-    }};
-
-    int dw = (int)ceil(fabsf(mm[1][0]) - mm[0][0]);
-    int dh = (int)ceil(fabsf(mm[1][1]) - mm[0][1]);
-    if (!simage_empty(dw, dh, sg_black, dst))
-        return false;
-    int x, y, sx, sy;
-    for (x = 0; x < dw; ++x)
-        for (y = 0; y < dh; ++y) {
-            sx = ((x + mm[0][0]) * c + (y + mm[0][1]) * s);
-            sy = ((y + mm[0][1]) * c - (x + mm[0][0]) * s);
-            if (sx < 0 || sx >= src->width || sy < 0 || sy >= src->height)
+    if (!(job.strip_start = calloc(h, 1)))
+        return -1;
+    parallel_for((int)h, w * h, label_rows, &job);
+
+    // Stitch the strips together along their first rows
+    for (size_t y = 1; y < h; y++) {
+        if (!job.strip_start[y])
+            continue;
+        for (size_t x = 0; x < w; x++) {
+            size_t i = y * w + x;
+            if (!labels[i])
+                continue;
+            if (job.desc.eight_connected && x > 0)
+                label_join(&job, i, i - w - 1);
+            label_join(&job, i, i - w);
+            if (job.desc.eight_connected && x + 1 < w)
+                label_join(&job, i, i - w + 1);
+        }
+    }
+    free(job.strip_start);
+
+    // Parents precede children, so one raster pass resolves every pixel to a compact label
+    simage_component *result = NULL;
+    double *sums = NULL;
+    for (size_t y = 0, i = 0; y < h; y++)
+        for (size_t x = 0; x < w; x++, i++) {
+            uint32_t l = labels[i];
+            if (!l)
                 continue;
-            simage_pset(dst, x, y, simage_pget(src, sx, sy));
+            if (l == i + 1) {
+                labels[i] = (uint32_t)++n;
+                if (stats && n > capacity) {
+                    capacity = capacity ? capacity * 2 : 64;
+                    simage_component *grown = realloc(result, capacity * sizeof(simage_component));
+                    double *grown_sums = realloc(sums, capacity * 2 * sizeof(double));
+                    if (grown)
+                        result = grown;
+                    if (grown_sums)
+                        sums = grown_sums;
+                    if (!grown || !grown_sums) {
+                        free(result);
+                        free(sums);
+                        return -1;
+                    }
+                }
+                // w/h hold the bottom-right corner until all pixels are counted
+                if (stats) {
+                    result[n - 1] = (simage_component){ .x = (int)x, .y = (int)y, .w = (int)x, .h = (int)y };
+                    sums[(n - 1) * 2] = sums[(n - 1) * 2 + 1] = 0;
+                }
+            } else
+                labels[i] = labels[l - 1];
+            if (stats) {
+                simage_component *c = &result[labels[i] - 1];
+                c->x = _MIN(c->x, (int)x);
+                c->w = _MAX(c->w, (int)x);
+                c->h = (int)y;
+                c->area++;
+                sums[(labels[i] - 1) * 2] += x;
+                sums[(labels[i] - 1) * 2 + 1] += y;
+            }
         }
+    if (stats) {
+        for (size_t i = 0; i < n; i++) {
+            simage_component *c = &result[i];
+            c->cx = (float)(sums[i * 2] / c->area);
+            c->cy = (float)(sums[i * 2 + 1] / c->area);
+            c->w = c->w - c->x + 1;
+            c->h = c->h - c->y + 1;
+        }
+        free(sums);
+        *stats = result;
+    }
+    return (int)n;
+}
+
+typedef struct blit {
+    int dx, dy, sx, sy, w, h;
+} blit_t;
+
+// Clip the source rect against src, then its placement at (x, y) against dst
+static bool clip_blit(simage_buffer *dst, simage_buffer *src, int x, int y, int rx, int ry, int rw, int rh, blit_t *out) {
+    int64_t sx0 = _MAX(rx, 0), sy0 = _MAX(ry, 0);
+    int64_t sx1 = _MIN((int64_t)rx + rw, (int64_t)src->width);
+    int64_t sy1 = _MIN((int64_t)ry + rh, (int64_t)src->height);
+    int64_t dx0 = (int64_t)x + (sx0 - rx), dy0 = (int64_t)y + (sy0 - ry);
+    if (dx0 < 0) {
+        sx0 -= dx0;
+        dx0 = 0;
+    }
+    if (dy0 < 0) {
+        sy0 -= dy0;
+        dy0 = 0;
+    }
+    sx1 = _MIN(sx1, sx0 + ((int64_t)dst->width - dx0));
+    sy1 = _MIN(sy1, sy0 + ((int64_t)dst->height - dy0));
+    if (!dst->buffer || !src->buffer || sx0 >= sx1 || sy0 >= sy1)
+        return false;
+    *out = (blit_t) {
+        .dx = (int)dx0, .dy = (int)dy0,
+        .sx = (int)sx0, .sy = (int)sy0,
+        .w = (int)(sx1 - sx0), .h = (int)(sy1 - sy0)
+    };
     return true;
 }
 
-void simage_rotate(simage_buffer *src, float angle) {
-    simage_buffer result;
-    if (!simage_rotated(src, angle, &result))
+/* sRGB <-> linear light tables, linear values are 12 bit. Alpha is already linear and only
+   widened to the same range */
+#define _LINEAR_BITS 12
+#define _LINEAR_MAX ((1 << _LINEAR_BITS) - 1)
+
+static uint16_t srgb_to_linear[256];
+static uint8_t linear_to_srgb[_LINEAR_MAX + 1];
+static bool srgb_tables_ready = false;
+static bool linear_light = false;
+
+// Called on the calling thread before any work is handed to other threads
+static void init_srgb_tables(void) {
+    if (srgb_tables_ready)
         return;
-    free(src->buffer);
-    memcpy(src, &result, sizeof(simage_buffer));
+    for (int i = 0; i < 256; i++) {
+        float c = i / 255.f;
+        c = c <= .04045f ? c / 12.92f : powf((c + .055f) / 1.055f, 2.4f);
+        srgb_to_linear[i] = (uint16_t)lroundf(c * _LINEAR_MAX);
+    }
+    for (int i = 0; i <= _LINEAR_MAX; i++) {
+        float l = (float)i / _LINEAR_MAX;
+        l = l <= .0031308f ? l * 12.92f : 1.055f * powf(l, 1.f / 2.4f) - .055f;
+        linear_to_srgb[i] = (uint8_t)lroundf(l * 255.f);
+    }
+    srgb_tables_ready = true;
 }
 
-bool simage_clipped(simage_buffer *src, int rx, int ry, int rw, int rh, simage_buffer *dst) {
-    int ox = _CLAMP(rx, 0, src->width);
-    int oy = _CLAMP(ry, 0, src->height);
-    if (ox >= src->width || oy >= src->height)
-        return false;
-    int mx = _MIN(ox + rw, src->width);
-    int my = _MIN(oy + rh, src->height);
-    int iw = mx - ox;
-    int ih = my - oy;
-    if (iw <= 0 || ih <= 0)
-        return false;
-    if (!simage_empty(iw, ih, sg_black, dst))
-        return false;
-    for (int px = 0; px < iw; px++)
-        for (int py = 0; py < ih; py++) {
-            int cx = ox + px;
-            int cy = oy + py;
-            simage_pset(dst, px, py, simage_pget(src, cx, cy));
-        }
-    return true;
+void simage_set_gamma_correct(bool enabled) {
+    if (enabled)
+        init_srgb_tables();
+    linear_light = enabled;
 }
 
-void simage_clip(simage_buffer *src, int rx, int ry, int rw, int rh) {
-    simage_buffer result;
-    if (!simage_clipped(src, rx, ry, rw, rh, &result))
-        return;
-    free(src->buffer);
-    memcpy(src, &result, sizeof(simage_buffer));
+bool simage_gamma_correct(void) {
+    return linear_light;
 }
 
-static inline void vline(simage_buffer *img, int x, int y0, int y1, sg_color color) {
-    if (y1 < y0) {
-        y0 += y1;
-        y1  = y0 - y1;
-        y0 -= y1;
-    }
-
-    if (x < 0 || x >= img->width || y0 >= img->height)
-        return;
+static inline void decode_linear(uint32_t p, int32_t out[4]) {
+    out[0] = (int32_t)(((p & 0xFF) * _LINEAR_MAX + 127) / 255);
+    for (int c = 1; c < 4; c++)
+        out[c] = srgb_to_linear[(p >> (c * 8)) & 0xFF];
+}
 
-    if (y0 < 0)
-        y0 = 0;
-    if (y1 >= img->height)
-        y1 = img->height - 1;
+static inline uint32_t encode_linear(const int32_t v[4]) {
+    uint32_t out = ((uint32_t)_CLAMP(v[0], 0, _LINEAR_MAX) * 255 + _LINEAR_MAX / 2) / _LINEAR_MAX;
+    for (int c = 1; c < 4; c++)
+        out |= (uint32_t)linear_to_srgb[_CLAMP(v[c], 0, _LINEAR_MAX)] << (c * 8);
+    return out;
+}
 
-    for(int y = y0; y <= y1; y++)
-        simage_pset(img, x, y, color);
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
 }
 
-static inline void hline(simage_buffer *img, int y, int x0, int x1, sg_color color) {
-    if (x1 < x0) {
-        x0 += x1;
-        x1  = x0 - x1;
-        x0 -= x1;
+/* All modes keep straight alpha in the low byte: out.a = sa + da * (1 - sa). The color
+   channels are mixed towards the blended color B(s, d) by the source alpha, except for
+   SIMAGE_BLEND_PREMULTIPLIED which expects the source colors already scaled by alpha */
+static inline uint32_t blend_pixel(uint32_t s, uint32_t d, simage_blend_mode mode) {
+    uint32_t sa = s & 0xFF, inv = 255 - sa;
+    uint32_t out = div255(sa * 255 + (d & 0xFF) * inv);
+    for (int i = 8; i < 32; i += 8) {
+        uint32_t sc = (s >> i) & 0xFF, dc = (d >> i) & 0xFF, b;
+        switch (mode) {
+            case SIMAGE_BLEND_PREMULTIPLIED:
+                out |= _MIN(sc + div255(dc * inv), 255) << i;
+                continue;
+            case SIMAGE_BLEND_ADD:
+                b = _MIN(sc + dc, 255);
+                break;
+            case SIMAGE_BLEND_MULTIPLY:
+                b = div255(sc * dc);
+                break;
+            case SIMAGE_BLEND_SCREEN:
+                b = sc + dc - div255(sc * dc);
+                break;
+            default:
+                b = sc;
+                break;
+        }
+        out |= div255(b * sa + dc * inv) << i;
     }
+    return out;
+}
+
+#if defined(SIMAGE_SSE2)
+static inline __m128i div255_sse2(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// a * b + c * d / 255 on bytes, through 16-bit lanes
+static inline __m128i mix_sse2(__m128i a, __m128i b, __m128i c, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+    return _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi));
+}
+
+static inline __m128i blend4_sse2(__m128i s, __m128i d, simage_blend_mode mode) {
+    const __m128i amask = _mm_set1_epi32(0xFF), zero = _mm_setzero_si128();
+    __m128i sa = _mm_and_si128(s, amask);
+    sa = _mm_or_si128(sa, _mm_slli_epi32(sa, 8));
+    sa = _mm_or_si128(sa, _mm_slli_epi32(sa, 16));
+    __m128i inv = _mm_xor_si128(sa, _mm_set1_epi32(-1)), b;
+    switch (mode) {
+        case SIMAGE_BLEND_PREMULTIPLIED:
+            return _mm_adds_epu8(s, mix_sse2(d, inv, zero, zero));
+        case SIMAGE_BLEND_ADD:
+            b = _mm_adds_epu8(s, d);
+            break;
+        case SIMAGE_BLEND_MULTIPLY:
+            b = mix_sse2(s, d, zero, zero);
+            break;
+        case SIMAGE_BLEND_SCREEN:
+            b = _mm_add_epi8(s, _mm_sub_epi8(d, mix_sse2(s, d, zero, zero)));
+            break;
+        default:
+            b = s;
+            break;
+    }
+    b = _mm_or_si128(_mm_andnot_si128(amask, b), _mm_and_si128(s, amask));
+    return mix_sse2(b, _mm_or_si128(sa, amask), d, inv);
+}
+#endif
 
-    if (y < 0 || y >= img->height || x0 >= img->width)
-        return;
-
-    if (x0 < 0)
-        x0 = 0;
-    if (x1 >= img->width)
-        x1 = img->width - 1;
-
-    for(int x = x0; x <= x1; x++)
-        simage_pset(img, x, y, color);
+#if defined(SIMAGE_AVX2)
+static inline __m256i div255_avx2(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
 }
 
-void simage_draw_line(simage_buffer *img, int x0, int y0, int x1, int y1, sg_color color) {
-    if (x0 == x1)
-        vline(img, x0, y0, y1, color);
-    else if (y0 == y1)
-        hline(img, y0, x0, x1, color);
-    else {
-        int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-        int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-        int err = (dx > dy ? dx : -dy) / 2;
+static inline __m256i mix_avx2(__m256i a, __m256i b, __m256i c, __m256i d) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+                                  _mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+                                  _mm256_mullo_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+    return _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi));
+}
 
-        while (simage_pset(img, x0, y0, color), x0 != x1 || y0 != y1) {
-            int e2 = err;
-            if (e2 > -dx) { err -= dy; x0 += sx; }
-            if (e2 <  dy) { err += dx; y0 += sy; }
-        }
+static inline __m256i blend8_avx2(__m256i s, __m256i d, simage_blend_mode mode) {
+    const __m256i amask = _mm256_set1_epi32(0xFF), zero = _mm256_setzero_si256();
+    __m256i sa = _mm256_and_si256(s, amask);
+    sa = _mm256_or_si256(sa, _mm256_slli_epi32(sa, 8));
+    sa = _mm256_or_si256(sa, _mm256_slli_epi32(sa, 16));
+    __m256i inv = _mm256_xor_si256(sa, _mm256_set1_epi32(-1)), b;
+    switch (mode) {
+        case SIMAGE_BLEND_PREMULTIPLIED:
+            return _mm256_adds_epu8(s, mix_avx2(d, inv, zero, zero));
+        case SIMAGE_BLEND_ADD:
+            b = _mm256_adds_epu8(s, d);
+            break;
+        case SIMAGE_BLEND_MULTIPLY:
+            b = mix_avx2(s, d, zero, zero);
+            break;
+        case SIMAGE_BLEND_SCREEN:
+            b = _mm256_add_epi8(s, _mm256_sub_epi8(d, mix_avx2(s, d, zero, zero)));
+            break;
+        default:
+            b = s;
+            break;
     }
+    b = _mm256_or_si256(_mm256_andnot_si256(amask, b), _mm256_and_si256(s, amask));
+    return mix_avx2(b, _mm256_or_si256(sa, amask), d, inv);
 }
+#endif
 
-void simage_draw_circle(simage_buffer *img, int xc, int yc, int r, sg_color color, int fill) {
-    int x = -r, y = 0, err = 2 - 2 * r; /* II. Quadrant */
-    do {
-        simage_pset(img, xc - x, yc + y, color);    /*   I. Quadrant */
-        simage_pset(img, xc - y, yc - x, color);    /*  II. Quadrant */
-        simage_pset(img, xc + x, yc - y, color);    /* III. Quadrant */
-        simage_pset(img, xc + y, yc + x, color);    /*  IV. Quadrant */
-
-        if (fill) {
-            hline(img, yc - y, xc - x, xc + x, color);
-            hline(img, yc + y, xc - x, xc + x, color);
-        }
+#if defined(SIMAGE_NEON)
+static inline uint8x8_t div255_neon(uint16x8_t x) {
+    x = vaddq_u16(x, vdupq_n_u16(128));
+    return vshrn_n_u16(vsraq_n_u16(x, x, 8), 8);
+}
 
-        r = err;
-        if (r <= y)
-            err += ++y * 2 + 1; /* e_xy+e_y < 0 */
-        if (r > x || err > y)
-            err += ++x * 2 + 1; /* e_xy+e_x > 0 or no 2nd y-step */
-    } while (x < 0);
+static inline uint8x16_t mix_neon(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) {
+    uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), vget_low_u8(b)), vget_low_u8(c), vget_low_u8(d));
+    uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), vget_high_u8(b)), vget_high_u8(c), vget_high_u8(d));
+    return vcombine_u8(div255_neon(lo), div255_neon(hi));
 }
 
-void simage_draw_rectangle(simage_buffer *img, int x, int y, int w, int h, sg_color color, int fill) {
+static inline uint8x16_t blend4_neon(uint8x16_t s, uint8x16_t d, simage_blend_mode mode) {
+    const uint8x16_t amask = vreinterpretq_u8_u32(vdupq_n_u32(0xFF)), zero = vdupq_n_u8(0);
+    uint32x4_t a = vandq_u32(vreinterpretq_u32_u8(s), vdupq_n_u32(0xFF));
+    uint8x16_t sa = vreinterpretq_u8_u32(vmulq_n_u32(a, 0x01010101));
+    uint8x16_t inv = vmvnq_u8(sa), b;
+    switch (mode) {
+        case SIMAGE_BLEND_PREMULTIPLIED:
+            return vqaddq_u8(s, mix_neon(d, inv, zero, zero));
+        case SIMAGE_BLEND_ADD:
+            b = vqaddq_u8(s, d);
+            break;
+        case SIMAGE_BLEND_MULTIPLY:
+            b = mix_neon(s, d, zero, zero);
+            break;
+        case SIMAGE_BLEND_SCREEN:
+            b = vaddq_u8(s, vsubq_u8(d, mix_neon(s, d, zero, zero)));
+            break;
+        default:
+            b = s;
+            break;
+    }
+    return mix_neon(vbslq_u8(amask, s, b), vorrq_u8(sa, amask), d, inv);
+}
+#endif
+
+static inline uint32_t blend_pixel_linear(uint32_t s, uint32_t d, simage_blend_mode mode) {
+    int32_t sc[4], dc[4], out[4];
+    int32_t sa = s & 0xFF, inv = 255 - sa;
+    decode_linear(s, sc);
+    decode_linear(d, dc);
+    out[0] = (sc[0] * 255 + dc[0] * inv + 127) / 255;
+    for (int i = 1; i < 4; i++) {
+        int32_t b;
+        switch (mode) {
+            case SIMAGE_BLEND_PREMULTIPLIED:
+                out[i] = sc[i] + (dc[i] * inv + 127) / 255;
+                continue;
+            case SIMAGE_BLEND_ADD:
+                b = sc[i] + dc[i];
+                break;
+            case SIMAGE_BLEND_MULTIPLY:
+                b = (sc[i] * dc[i] + _LINEAR_MAX / 2) / _LINEAR_MAX;
+                break;
+            case SIMAGE_BLEND_SCREEN:
+                b = sc[i] + dc[i] - (sc[i] * dc[i] + _LINEAR_MAX / 2) / _LINEAR_MAX;
+                break;
+            default:
+                b = sc[i];
+                break;
+        }
+        out[i] = (_MIN(b, _LINEAR_MAX) * sa + dc[i] * inv + 127) / 255;
+    }
+    return encode_linear(out);
+}
+
+static inline void blend_row_mode(uint32_t *d, const uint32_t *s, int n, simage_blend_mode mode) {
+    int i = 0;
+#if defined(SIMAGE_AVX2)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i*)(d + i), blend8_avx2(_mm256_loadu_si256((const __m256i*)(s + i)), _mm256_loadu_si256((const __m256i*)(d + i)), mode));
+#endif
+#if defined(SIMAGE_SSE2)
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i*)(d + i), blend4_sse2(_mm_loadu_si128((const __m128i*)(s + i)), _mm_loadu_si128((const __m128i*)(d + i)), mode));
+#elif defined(SIMAGE_NEON)
+    for (; i + 4 <= n; i += 4)
+        vst1q_u8((uint8_t*)(d + i), blend4_neon(vld1q_u8((const uint8_t*)(s + i)), vld1q_u8((const uint8_t*)(d + i)), mode));
+#endif
+    for (; i < n; i++)
+        d[i] = blend_pixel(s[i], d[i], mode);
+}
+
+static void blend_row(uint32_t *d, const uint32_t *s, int n, simage_blend_mode mode) {
+    if (linear_light && mode != SIMAGE_BLEND_NONE) {
+        for (int i = 0; i < n; i++)
+            d[i] = blend_pixel_linear(s[i], d[i], mode);
+        return;
+    }
+    switch (mode) {
+        case SIMAGE_BLEND_NONE:
+            memmove(d, s, n * sizeof(uint32_t));
+            break;
+        case SIMAGE_BLEND_PREMULTIPLIED:
+            blend_row_mode(d, s, n, SIMAGE_BLEND_PREMULTIPLIED);
+            break;
+        case SIMAGE_BLEND_ADD:
+            blend_row_mode(d, s, n, SIMAGE_BLEND_ADD);
+            break;
+        case SIMAGE_BLEND_MULTIPLY:
+            blend_row_mode(d, s, n, SIMAGE_BLEND_MULTIPLY);
+            break;
+        case SIMAGE_BLEND_SCREEN:
+            blend_row_mode(d, s, n, SIMAGE_BLEND_SCREEN);
+            break;
+        default:
+            blend_row_mode(d, s, n, SIMAGE_BLEND_ALPHA);
+            break;
+    }
+}
+
+static void blit_rows(simage_buffer *dst, simage_buffer *src, blit_t *b, simage_blend_mode mode) {
+    // Pasting an image onto itself further down has to walk the rows bottom-up
+    bool reverse = dst->buffer == src->buffer && b->dy > b->sy;
+    for (int i = 0; i < b->h; i++) {
+        int r = reverse ? b->h - 1 - i : i;
+        blend_row(simage_row_ptr(dst, b->dy + r) + b->dx, simage_row_ptr(src, b->sy + r) + b->sx, b->w, mode);
+    }
+}
+
+void simage_clipped_blend(simage_buffer *dst, simage_buffer *src, int x, int y, int rx, int ry, int rw, int rh, simage_blend_mode mode) {
+    blit_t b;
+    if (clip_blit(dst, src, x, y, rx, ry, rw, rh, &b))
+        blit_rows(dst, src, &b, mode);
+}
+
+void simage_blend(simage_buffer *dst, simage_buffer *src, int x, int y, simage_blend_mode mode) {
+    simage_clipped_blend(dst, src, x, y, 0, 0, src->width, src->height, mode);
+}
+
+typedef struct blit_batch {
+    simage_buffer *dst;
+    const simage_blit_cmd *cmds;
+    blit_t *blits;
+    uint32_t *bins, *offsets;
+    int tiles_x;
+} blit_batch_t;
+
+static void blit_tiles(void *userdata, int begin, int end) {
+    blit_batch_t *batch = (blit_batch_t*)userdata;
+    for (int t = begin; t < end; t++) {
+        int tx0 = (t % batch->tiles_x) * SIMAGE_BLIT_TILE, ty0 = (t / batch->tiles_x) * SIMAGE_BLIT_TILE;
+        int tx1 = _MIN(tx0 + SIMAGE_BLIT_TILE, (int)batch->dst->width);
+        int ty1 = _MIN(ty0 + SIMAGE_BLIT_TILE, (int)batch->dst->height);
+        for (uint32_t i = batch->offsets[t]; i < batch->offsets[t + 1]; i++) {
+            uint32_t c = batch->bins[i];
+            blit_t *a = &batch->blits[c];
+            int x0 = _MAX(a->dx, tx0), y0 = _MAX(a->dy, ty0);
+            int x1 = _MIN(a->dx + a->w, tx1), y1 = _MIN(a->dy + a->h, ty1);
+            blit_t b = {
+                .dx = x0, .dy = y0,
+                .sx = a->sx + x0 - a->dx, .sy = a->sy + y0 - a->dy,
+                .w = x1 - x0, .h = y1 - y0
+            };
+            blit_rows(batch->dst, batch->cmds[c].src, &b, batch->cmds[c].mode);
+        }
+    }
+}
+
+void simage_blit_batch(simage_buffer *dst, const simage_blit_cmd *cmds, size_t n) {
+    if (!dst->buffer || !n || n >= UINT32_MAX)
+        return;
+    int tiles_x = (int)((dst->width + SIMAGE_BLIT_TILE - 1) / SIMAGE_BLIT_TILE);
+    int tiles_y = (int)((dst->height + SIMAGE_BLIT_TILE - 1) / SIMAGE_BLIT_TILE);
+    size_t tiles = (size_t)tiles_x * tiles_y;
+    // Tiles are indexed with ints, more of them than that run serially
+    bool binned = tiles < INT_MAX;
+    blit_batch_t batch = {
+        .dst = dst,
+        .cmds = cmds,
+        .tiles_x = tiles_x,
+        .blits = binned ? malloc(n * sizeof(blit_t)) : NULL,
+        .offsets = binned ? calloc(tiles + 1, sizeof(uint32_t)) : NULL
+    };
+    size_t entries = 0, pixels = 0;
+    bool serial = !batch.blits || !batch.offsets;
+    for (size_t i = 0; !serial && i < n; i++) {
+        const simage_blit_cmd *c = &cmds[i];
+        blit_t *b = &batch.blits[i];
+        if (!c->src || !clip_blit(dst, c->src, c->x, c->y, c->rx, c->ry, c->rw ? c->rw : (int)c->src->width, c->rh ? c->rh : (int)c->src->height, b)) {
+            b->w = b->h = 0;
+            continue;
+        }
+        // Tiles can't be processed independently when a blit reads from the destination
+        if (c->src->buffer == dst->buffer)
+            serial = true;
+        for (int ty = b->dy / SIMAGE_BLIT_TILE; ty <= (b->dy + b->h - 1) / SIMAGE_BLIT_TILE; ty++)
+            for (int tx = b->dx / SIMAGE_BLIT_TILE; tx <= (b->dx + b->w - 1) / SIMAGE_BLIT_TILE; tx++, entries++)
+                batch.offsets[ty * tiles_x + tx + 1]++;
+        pixels += (size_t)b->w * b->h;
+    }
+    // Bin offsets are 32 bits
+    if (!serial && (entries >= UINT32_MAX || !(batch.bins = malloc(_MAX(entries, 1) * sizeof(uint32_t)))))
+        serial = true;
+    if (serial) {
+        for (size_t i = 0; i < n; i++)
+            if (cmds[i].src)
+                simage_clipped_blend(dst, cmds[i].src, cmds[i].x, cmds[i].y, cmds[i].rx, cmds[i].ry,
+                                     cmds[i].rw ? cmds[i].rw : (int)cmds[i].src->width,
+                                     cmds[i].rh ? cmds[i].rh : (int)cmds[i].src->height, cmds[i].mode);
+        goto BAIL;
+    }
+    for (size_t t = 0; t < tiles; t++)
+        batch.offsets[t + 1] += batch.offsets[t];
+    // Bin commands in submission order, offsets[t] is used as the insertion cursor then restored
+    for (size_t i = 0; i < n; i++) {
+        blit_t *b = &batch.blits[i];
+        if (!b->w || !b->h)
+            continue;
+        for (int ty = b->dy / SIMAGE_BLIT_TILE; ty <= (b->dy + b->h - 1) / SIMAGE_BLIT_TILE; ty++)
+            for (int tx = b->dx / SIMAGE_BLIT_TILE; tx <= (b->dx + b->w - 1) / SIMAGE_BLIT_TILE; tx++)
+                batch.bins[batch.offsets[ty * tiles_x + tx]++] = (uint32_t)i;
+    }
+    for (size_t t = tiles; t > 0; t--)
+        batch.offsets[t] = batch.offsets[t - 1];
+    batch.offsets[0] = 0;
+    parallel_for((int)tiles, pixels, blit_tiles, &batch);
+BAIL:
+    if (batch.blits)
+        free(batch.blits);
+    if (batch.offsets)
+        free(batch.offsets);
+    if (batch.bins)
+        free(batch.bins);
+}
+
+enum {
+    SPRITE_RUN_SKIP,
+    SPRITE_RUN_COPY,
+    SPRITE_RUN_BLEND
+};
+
+#define _RUN(TYPE, LENGTH) (((uint32_t)(TYPE) << 30) | (uint32_t)(LENGTH))
+#define _RUN_TYPE(RUN) ((RUN) >> 30)
+#define _RUN_LENGTH(RUN) ((RUN) & 0x3FFFFFFF)
+
+static inline int sprite_run_type(uint32_t color) {
+    uint32_t a = color & 0xFF;
+    return a == 0 ? SPRITE_RUN_SKIP : a == 255 ? SPRITE_RUN_COPY : SPRITE_RUN_BLEND;
+}
+
+// Encode one row into out (when not NULL), returns the number of words needed
+static size_t sprite_encode_row(const uint32_t *row, unsigned int width, uint32_t *out) {
+    size_t n = 0;
+    for (unsigned int x = 0; x < width;) {
+        int type = sprite_run_type(row[x]);
+        unsigned int end = x + 1;
+        while (end < width && sprite_run_type(row[end]) == type)
+            end++;
+        if (out)
+            out[n] = _RUN(type, end - x);
+        n++;
+        if (type != SPRITE_RUN_SKIP) {
+            if (out)
+                memcpy(out + n, row + x, (end - x) * sizeof(uint32_t));
+            n += end - x;
+        }
+        x = end;
+    }
+    return n;
+}
+
+bool simage_compile_sprite(simage_buffer *src, simage_sprite *dst) {
+    if (!src->buffer || src->width >= 0x40000000)
+        return false;
+    size_t size = src->height + 1;
+    for (unsigned int y = 0; y < src->height; y++)
+        size += sprite_encode_row(simage_row_ptr(src, y), src->width, NULL);
+    if (size >= UINT32_MAX || !(dst->data = malloc(size * sizeof(uint32_t))))
+        return false;
+    dst->width = src->width;
+    dst->height = src->height;
+    uint32_t offset = src->height + 1;
+    for (unsigned int y = 0; y < src->height; y++) {
+        dst->data[y] = offset;
+        offset += (uint32_t)sprite_encode_row(simage_row_ptr(src, y), src->width, dst->data + offset);
+    }
+    dst->data[src->height] = offset;
+    return true;
+}
+
+void simage_destroy_sprite(simage_sprite *sprite) {
+    if (sprite && sprite->data) {
+        free(sprite->data);
+        memset(sprite, 0, sizeof(simage_sprite));
+    }
+}
+
+void simage_blit_sprite(simage_buffer *dst, simage_sprite *sprite, int x, int y) {
+    if (!dst->buffer || !sprite->data)
+        return;
+    int y0 = _MAX(y, 0), y1 = (int)_MIN((int64_t)y + sprite->height, (int64_t)dst->height);
+    for (int py = y0; py < y1; py++) {
+        const uint32_t *run = sprite->data + sprite->data[py - y];
+        const uint32_t *end = sprite->data + sprite->data[py - y + 1];
+        uint32_t *row = simage_row_ptr(dst, py);
+        int64_t px = x;
+        while (run < end && px < dst->width) {
+            int type = _RUN_TYPE(*run);
+            int64_t length = _RUN_LENGTH(*run++);
+            if (type != SPRITE_RUN_SKIP) {
+                int64_t a = _MAX(px, 0), b = _MIN(px + length, (int64_t)dst->width);
+                if (a < b) {
+                    if (type == SPRITE_RUN_COPY)
+                        memcpy(row + a, run + (a - px), (b - a) * sizeof(uint32_t));
+                    else
+                        blend_row(row + a, run + (a - px), (int)(b - a), SIMAGE_BLEND_ALPHA);
+                }
+                run += length;
+            }
+            px += length;
+        }
+    }
+}
+
+void simage_paste(simage_buffer *dst, simage_buffer *src, int x, int y) {
+    simage_clipped_blend(dst, src, x, y, 0, 0, src->width, src->height, SIMAGE_BLEND_NONE);
+}
+
+void simage_clipped_paste(simage_buffer *dst, simage_buffer *src, int x, int y, int rx, int ry, int rw, int rh) {
+    simage_clipped_blend(dst, src, x, y, rx, ry, rw, rh, SIMAGE_BLEND_NONE);
+}
+
+bool simage_dupe(simage_buffer *src, simage_buffer *dst) {
+    if (!simage_empty(src->width, src->height, sg_black, dst))
+        return false;
+    memcpy(dst->buffer, src->buffer, (size_t)src->width * src->height * sizeof(uint32_t));
+    return true;
+}
+
+typedef struct nearest_job {
+    simage_buffer *src, *dst;
+    uint64_t x_step, y_step;
+} nearest_job_t;
+
+static void nearest_rows(void *userdata, int begin, int end) {
+    nearest_job_t *job = (nearest_job_t*)userdata;
+    uint64_t y_pos = (job->y_step >> 1) + job->y_step * begin;
+    for (int i = begin; i < end; ++i, y_pos += job->y_step) {
+        uint32_t *t = simage_row_ptr(job->dst, i);
+        uint32_t *p = simage_row_ptr(job->src, (int)(y_pos >> 32));
+        uint64_t x_pos = job->x_step >> 1;
+        for (unsigned int j = 0; j < job->dst->width; ++j, x_pos += job->x_step)
+            t[j] = p[x_pos >> 32];
+    }
+}
+
+// Averages (1 << shift) square blocks, rows holds the (1 << shift) source rows of one output row
+static void box_span(const uint32_t **rows, int shift, uint32_t *out, int n) {
+    int f = 1 << shift, x = 0;
+#if defined(SIMAGE_SSE2)
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16((short)(1 << (shift * 2 - 1)));
+    const __m128i count = _mm_cvtsi32_si128(shift * 2);
+    if (shift == 1)
+        for (; x + 2 <= n; x += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[0] + x * 2));
+            __m128i b = _mm_loadu_si128((const __m128i*)(rows[1] + x * 2));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            __m128i sum = _mm_srl_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), count);
+            _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+        }
+    else
+        for (; x + 4 <= n; x += 4) {
+            /* Four blocks at a time, each summed into two pixels' worth of 16 bit lanes and folded
+               at the end. 8x8 blocks sum to at most 16320, 16 bit lanes are enough */
+            __m128i acc[4];
+            for (int k = 0; k < 4; k++) {
+                __m128i sum = zero;
+                for (int i = 0; i < f; i++)
+                    for (int j = 0; j < f; j += 4) {
+                        __m128i p = _mm_loadu_si128((const __m128i*)(rows[i] + (x + k) * f + j));
+                        sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero)));
+                    }
+                acc[k] = sum;
+            }
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(acc[0], acc[1]), _mm_unpackhi_epi64(acc[0], acc[1]));
+            __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(acc[2], acc[3]), _mm_unpackhi_epi64(acc[2], acc[3]));
+            lo = _mm_srl_epi16(_mm_add_epi16(lo, round), count);
+            hi = _mm_srl_epi16(_mm_add_epi16(hi, round), count);
+            _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+        }
+#elif defined(SIMAGE_NEON)
+    if (shift == 1)
+        for (; x + 2 <= n; x += 2) {
+            uint8x16_t a = vld1q_u8((const uint8_t*)(rows[0] + x * 2)), b = vld1q_u8((const uint8_t*)(rows[1] + x * 2));
+            uint16x8_t lo = vaddl_u8(vget_low_u8(a), vget_low_u8(b));
+            uint16x8_t hi = vaddl_u8(vget_high_u8(a), vget_high_u8(b));
+            uint16x4_t l = vadd_u16(vget_low_u16(lo), vget_high_u16(lo));
+            uint16x4_t h = vadd_u16(vget_low_u16(hi), vget_high_u16(hi));
+            vst1_u8((uint8_t*)(out + x), vrshrn_n_u16(vcombine_u16(l, h), 2));
+        }
+    else
+        for (; x + 4 <= n; x += 4) {
+            // Same layout as the SSE2 path, four blocks folded from two pixels of 16 bit lanes each
+            uint16x8_t acc[4];
+            for (int k = 0; k < 4; k++) {
+                uint16x8_t sum = vdupq_n_u16(0);
+                for (int i = 0; i < f; i++)
+                    for (int j = 0; j < f; j += 4) {
+                        uint8x16_t p = vld1q_u8((const uint8_t*)(rows[i] + (x + k) * f + j));
+                        sum = vaddq_u16(sum, vaddl_u8(vget_low_u8(p), vget_high_u8(p)));
+                    }
+                acc[k] = sum;
+            }
+            const int16x8_t count = vdupq_n_s16((int16_t)(-2 * shift));
+            uint16x8_t lo = vcombine_u16(vadd_u16(vget_low_u16(acc[0]), vget_high_u16(acc[0])), vadd_u16(vget_low_u16(acc[1]), vget_high_u16(acc[1])));
+            uint16x8_t hi = vcombine_u16(vadd_u16(vget_low_u16(acc[2]), vget_high_u16(acc[2])), vadd_u16(vget_low_u16(acc[3]), vget_high_u16(acc[3])));
+            vst1q_u8((uint8_t*)(out + x), vcombine_u8(vmovn_u16(vrshlq_u16(lo, count)), vmovn_u16(vrshlq_u16(hi, count))));
+        }
+#endif
+    for (; x < n; x++) {
+        uint32_t sum[4] = {0};
+        for (int i = 0; i < f; i++)
+            for (int j = 0; j < f; j++) {
+                uint32_t p = rows[i][x * f + j];
+                for (int c = 0; c < 4; c++)
+                    sum[c] += (p >> (c * 8)) & 0xFF;
+            }
+        uint32_t result = 0;
+        for (int c = 0; c < 4; c++)
+            result |= ((sum[c] + (1u << (shift * 2 - 1))) >> (shift * 2)) << (c * 8);
+        out[x] = result;
+    }
+}
+
+static void box_span_linear(const uint32_t **rows, int shift, uint32_t *out, int n) {
+    int f = 1 << shift;
+    for (int x = 0; x < n; x++) {
+        int32_t sum[4] = {0}, v[4];
+        for (int i = 0; i < f; i++)
+            for (int j = 0; j < f; j++) {
+                decode_linear(rows[i][x * f + j], v);
+                for (int c = 0; c < 4; c++)
+                    sum[c] += v[c];
+            }
+        for (int c = 0; c < 4; c++)
+            sum[c] = (sum[c] + (1 << (shift * 2 - 1))) >> (shift * 2);
+        out[x] = encode_linear(sum);
+    }
+}
+
+typedef struct box_job {
+    simage_buffer *src, *dst;
+    int shift;
+    bool linear;
+} box_job_t;
+
+static void box_rows(void *userdata, int begin, int end) {
+    box_job_t *job = (box_job_t*)userdata;
+    const uint32_t *rows[8];
+    for (int y = begin; y < end; y++) {
+        for (int i = 0; i < 1 << job->shift; i++)
+            rows[i] = simage_row_ptr(job->src, (y << job->shift) + i);
+        (job->linear ? box_span_linear : box_span)(rows, job->shift, simage_row_ptr(job->dst, y), job->dst->width);
+    }
+}
+
+/* Area averaging for reductions. A source pixel spans nw (nh) units and a destination pixel
+   sw (sh) units, so every source pixel overlaps at most two destination pixels per axis and the
+   weights are exact integers. Each band collapses its source rows once into `row`, then
+   accumulates them into `acc` until the destination row is complete */
+typedef struct area_job {
+    simage_buffer *src, *dst;
+    uint32_t *rows;
+    uint64_t *accs;
+    int bands;
+    bool linear;
+} area_job_t;
+
+static void area_collapse(const uint32_t *p, int sw, int nw, bool linear, uint32_t *row) {
+    memset(row, 0, (size_t)nw * 4 * sizeof(uint32_t));
+    uint32_t *out = row;
+    int64_t edge = sw;
+    for (int x = 0; x < sw; x++) {
+        int32_t v[4];
+        if (linear)
+            decode_linear(p[x], v);
+        else
+            for (int c = 0; c < 4; c++)
+                v[c] = (p[x] >> (c * 8)) & 0xFF;
+        int64_t lo = (int64_t)x * nw, hi = lo + nw;
+        if (hi <= edge) {
+            for (int c = 0; c < 4; c++)
+                out[c] += v[c] * nw;
+            if (hi == edge) {
+                out += 4;
+                edge += sw;
+            }
+        } else {
+            uint32_t a = (uint32_t)(edge - lo), b = nw - a;
+            for (int c = 0; c < 4; c++) {
+                out[c] += v[c] * a;
+                out[c + 4] += v[c] * b;
+            }
+            out += 4;
+            edge += sw;
+        }
+    }
+}
+
+static void area_bands(void *userdata, int begin, int end) {
+    area_job_t *job = (area_job_t*)userdata;
+    int sw = job->src->width, sh = job->src->height, nw = job->dst->width, nh = job->dst->height;
+    uint64_t total = (uint64_t)sw * sh;
+    for (int band = begin; band < end; band++) {
+        uint32_t *row = job->rows + (size_t)band * nw * 4;
+        uint64_t *acc = job->accs + (size_t)band * nw * 4;
+        int collapsed = -1;
+        for (int y = (int)((int64_t)nh * band / job->bands); y < (int)((int64_t)nh * (band + 1) / job->bands); y++) {
+            memset(acc, 0, (size_t)nw * 4 * sizeof(uint64_t));
+            int64_t top = (int64_t)y * sh, bottom = top + sh;
+            for (int sy = (int)(top / nh); sy < sh && (int64_t)sy * nh < bottom; sy++) {
+                uint64_t weight = (uint64_t)(_MIN((int64_t)(sy + 1) * nh, bottom) - _MAX((int64_t)sy * nh, top));
+                if (sy != collapsed) {
+                    area_collapse(simage_row_ptr(job->src, sy), sw, nw, job->linear, row);
+                    collapsed = sy;
+                }
+                for (int i = 0; i < nw * 4; i++)
+                    acc[i] += row[i] * weight;
+            }
+            uint32_t *out = simage_row_ptr(job->dst, y);
+            for (int x = 0; x < nw; x++) {
+                int32_t v[4];
+                for (int c = 0; c < 4; c++)
+                    v[c] = (int32_t)((acc[x * 4 + c] + total / 2) / total);
+                out[x] = job->linear ? encode_linear(v) : (uint32_t)(v[0] | v[1] << 8 | v[2] << 16 | (uint32_t)v[3] << 24);
+            }
+        }
+    }
+}
+
+// dst must already be allocated and no larger than src on either axis
+static bool area_resize(simage_buffer *src, simage_buffer *dst, bool linear) {
+    int bands = _MIN(simage_thread_count(), (int)dst->height);
+    area_job_t job = {
+        .src = src,
+        .dst = dst,
+        .rows = malloc((size_t)bands * dst->width * 4 * sizeof(uint32_t)),
+        .accs = malloc((size_t)bands * dst->width * 4 * sizeof(uint64_t)),
+        .bands = bands,
+        .linear = linear
+    };
+    bool result = job.rows && job.accs;
+    if (result) {
+        if (linear)
+            init_srgb_tables();
+        parallel_for(bands, (size_t)src->width * src->height, area_bands, &job);
+    }
+    free(job.rows);
+    free(job.accs);
+    return result;
+}
+
+bool simage_resized(simage_buffer *src, int nw, int nh, simage_buffer *dst) {
+    if (!src->buffer || nw <= 0 || nh <= 0 || !simage_empty(nw, nh, sg_black, dst))
+        return false;
+    // Exact 2x, 4x and 8x reductions are box filtered
+    for (int shift = 1; shift <= 3; shift++)
+        if (src->width == (uint64_t)nw << shift && src->height == (uint64_t)nh << shift) {
+            box_job_t job = { .src = src, .dst = dst, .shift = shift, .linear = linear_light };
+            parallel_for(nh, (size_t)src->width * src->height, box_rows, &job);
+            return true;
+        }
+    // Nearest neighbour aliases badly past 4x, average the covered area instead
+    if (src->width >= (unsigned int)nw && src->height >= (unsigned int)nh &&
+        (src->width > (uint64_t)nw * 4 || src->height > (uint64_t)nh * 4) &&
+        area_resize(src, dst, linear_light))
+        return true;
+    // 32.32 fixed point, sampling at pixel centers
+    nearest_job_t job = {
+        .src = src,
+        .dst = dst,
+        .x_step = ((uint64_t)src->width << 32) / nw,
+        .y_step = ((uint64_t)src->height << 32) / nh
+    };
+    parallel_for(nh, (size_t)nw * nh, nearest_rows, &job);
+    return true;
+}
+
+void simage_resize(simage_buffer *src, int nw, int nh) {
+    simage_buffer result;
+    if (!simage_resized(src, nw, nh, &result))
+        return;
+    free(src->buffer);
+    memcpy(src, &result, sizeof(simage_buffer));
+}
+
+#define _FILTER_BITS 14
+#define _FILTER_ONE (1 << _FILTER_BITS)
+
+static float filter_support(simage_filter filter) {
+    switch (filter) {
+        case SIMAGE_FILTER_BILINEAR:
+            return 1.f;
+        case SIMAGE_FILTER_BICUBIC:
+        case SIMAGE_FILTER_MITCHELL:
+            return 2.f;
+        case SIMAGE_FILTER_LANCZOS3:
+            return 3.f;
+        case SIMAGE_FILTER_KAISER:
+            return 2.f;
+        default:
+            return .5f;
+    }
+}
+
+static float bessel_i0(float x) {
+    float sum = 1.f, term = 1.f;
+    for (int k = 1; k < 16; k++) {
+        term *= (x / (2.f * k)) * (x / (2.f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static float filter_weight(simage_filter filter, float x) {
+    x = fabsf(x);
+    switch (filter) {
+        case SIMAGE_FILTER_BILINEAR:
+            return x < 1.f ? 1.f - x : 0.f;
+        case SIMAGE_FILTER_BICUBIC: // Catmull-Rom, B = 0, C = 0.5
+            if (x < 1.f)
+                return 1.5f * x * x * x - 2.5f * x * x + 1.f;
+            return x < 2.f ? -.5f * x * x * x + 2.5f * x * x - 4.f * x + 2.f : 0.f;
+        case SIMAGE_FILTER_MITCHELL: // B = C = 1/3
+            if (x < 1.f)
+                return (7.f * x * x * x - 12.f * x * x + 16.f / 3.f) / 6.f;
+            return x < 2.f ? (-7.f / 3.f * x * x * x + 12.f * x * x - 20.f * x + 32.f / 3.f) / 6.f : 0.f;
+        case SIMAGE_FILTER_LANCZOS3:
+            if (x < 1e-5f)
+                return 1.f;
+            if (x >= 3.f)
+                return 0.f;
+            x *= 3.14159265f;
+            return 3.f * sinf(x) * sinf(x / 3.f) / (x * x);
+        case SIMAGE_FILTER_KAISER: // Kaiser windowed sinc, alpha = 4
+            if (x >= 2.f)
+                return 0.f;
+            return (x < 1e-5f ? 1.f : sinf(x * 3.14159265f) / (x * 3.14159265f)) * bessel_i0(4.f * sqrtf(1.f - x * x / 4.f)) / bessel_i0(4.f);
+        default:
+            return x <= .5f ? 1.f : 0.f;
+    }
+}
+
+/* Per destination pixel along one axis: the first source pixel and `taps` fixed point weights.
+   Every pixel uses the same number of taps (zero padded) so the inner loops stay branch free.
+   Weights have _FILTER_BITS of fraction for the 16 bit SIMD kernels, kernels wider than
+   _FILTER_WIDE_TAPS (large reductions) keep `wide` weights with _FILTER_WIDE_BITS instead so
+   their many small weights keep their precision, summed in 64 bits */
+#define _FILTER_WIDE_TAPS 32
+#define _FILTER_WIDE_BITS 22
+
+typedef struct resample_axis {
+    int taps, bits;
+    int *first;
+    int16_t *weights;
+    int32_t *wide;
+} resample_axis_t;
+
+static inline int32_t axis_weight(const resample_axis_t *axis, int i, int t) {
+    size_t k = (size_t)i * axis->taps + t;
+    return axis->wide ? axis->wide[k] : axis->weights[k];
+}
+
+static void free_resample_axis(resample_axis_t *axis) {
+    if (axis->first)
+        free(axis->first);
+    if (axis->weights)
+        free(axis->weights);
+    if (axis->wide)
+        free(axis->wide);
+}
+
+static bool build_resample_axis(int src_size, int dst_size, simage_filter filter, resample_axis_t *axis) {
+    float scale = (float)dst_size / src_size;
+    float stretch = scale < 1.f ? 1.f / scale : 1.f;
+    float support = filter_support(filter) * stretch;
+    int taps = _MIN((int)ceilf(support * 2.f) + 1, src_size);
+    float *folded = malloc(src_size * sizeof(float));
+    axis->taps = taps;
+    axis->bits = taps > _FILTER_WIDE_TAPS ? _FILTER_WIDE_BITS : _FILTER_BITS;
+    axis->first = malloc(dst_size * sizeof(int));
+    axis->weights = NULL;
+    axis->wide = NULL;
+    if (axis->bits == _FILTER_BITS)
+        axis->weights = calloc((size_t)dst_size * taps, sizeof(int16_t));
+    else
+        axis->wide = calloc((size_t)dst_size * taps, sizeof(int32_t));
+    if (!folded || !axis->first || (!axis->weights && !axis->wide)) {
+        if (folded)
+            free(folded);
+        free_resample_axis(axis);
+        return false;
+    }
+    for (int i = 0; i < dst_size; i++) {
+        float center = (i + .5f) / scale;
+        int lo = (int)floorf(center - support), hi = (int)ceilf(center + support);
+        int a = _CLAMP(lo, 0, src_size - 1), b = _CLAMP(hi, 0, src_size - 1);
+        float total = 0.f;
+        for (int k = a; k <= b; k++)
+            folded[k] = 0.f;
+        // Taps falling outside the image are folded onto the edge pixels
+        for (int j = lo; j <= hi; j++) {
+            float w = filter_weight(filter, (j + .5f - center) / stretch);
+            folded[_CLAMP(j, 0, src_size - 1)] += w;
+            total += w;
+        }
+        while (a < b && folded[a] == 0.f)
+            a++;
+        while (b > a && folded[b] == 0.f)
+            b--;
+        if (total == 0.f)
+            folded[a] = total = 1.f;
+        b = _MIN(b, a + taps - 1);
+        int first = _MIN(a, src_size - taps);
+        // Rounding the running sum spreads the rounding error over the taps and keeps the total exact
+        int32_t one = 1 << axis->bits, rounded = 0;
+        double sum = 0.;
+        for (int k = a; k <= b; k++) {
+            sum += folded[k] / total;
+            int32_t next = k == b ? one : (int32_t)lround(sum * one);
+            if (axis->wide)
+                axis->wide[(size_t)i * taps + k - first] = next - rounded;
+            else
+                axis->weights[(size_t)i * taps + k - first] = (int16_t)(next - rounded);
+            rounded = next;
+        }
+        axis->first[i] = first;
+    }
+    free(folded);
+    return true;
+}
+
+static inline uint32_t clamp_channel(int32_t v) {
+    v = (v + (1 << (_FILTER_BITS - 1))) >> _FILTER_BITS;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint32_t)v;
+}
+
+#if defined(SIMAGE_SSE2)
+// Two weights interleaved for _mm_madd_epi16
+static inline int weight_pair(int16_t a, int16_t b) {
+    return (int)((uint32_t)(uint16_t)b << 16 | (uint16_t)a);
+}
+#endif
+
+/* Filtering straight alpha bleeds the color of transparent pixels into their neighbours, so
+   translucent images are filtered premultiplied and converted back afterwards */
+static inline uint32_t premultiply(uint32_t p) {
+    uint32_t a = p & 0xFF;
+    if (a == 255)
+        return p;
+    return a | div255(((p >> 8) & 0xFF) * a) << 8 | div255(((p >> 16) & 0xFF) * a) << 16 | div255((p >> 24) * a) << 24;
+}
+
+// scale holds 255 / a in 16.16, filter ringing can leave colors above alpha so they're clamped
+static inline uint32_t unpremultiply(uint32_t p, const uint32_t *scale) {
+    uint32_t a = p & 0xFF, out = a;
+    if (a == 255 || !a)
+        return a ? p : 0;
+    for (int i = 8; i < 32; i += 8)
+        out |= _MIN((((p >> i) & 0xFF) * scale[a] + (1 << 15)) >> 16, 255) << i;
+    return out;
+}
+
+static void premultiply_rows(void *userdata, int begin, int end) {
+    simage_buffer *img = (simage_buffer*)userdata;
+    for (int y = begin; y < end; y++) {
+        uint32_t *row = simage_row_ptr(img, y);
+        for (unsigned int x = 0; x < img->width; x++)
+            row[x] = premultiply(row[x]);
+    }
+}
+
+static bool is_translucent(simage_buffer *img) {
+    size_t n = (size_t)img->width * img->height;
+    for (size_t i = 0; i < n; i++)
+        if ((img->buffer[i] & 0xFF) != 0xFF)
+            return true;
+    return false;
+}
+
+// Wide kernels: 64 bit sums of `taps` pixels `stride` apart
+static inline uint32_t filter_wide(const uint32_t *p, size_t stride, const int32_t *w, int taps, int bits) {
+    int64_t acc[4] = {0};
+    for (int t = 0; t < taps; t++) {
+        uint32_t c = p[t * stride];
+        for (int k = 0; k < 4; k++)
+            acc[k] += (int64_t)((c >> (k * 8)) & 0xFF) * w[t];
+    }
+    uint32_t out = 0;
+    for (int k = 0; k < 4; k++) {
+        int64_t v = (acc[k] + ((int64_t)1 << (bits - 1))) >> bits;
+        out |= (uint32_t)_CLAMP(v, 0, 255) << (k * 8);
+    }
+    return out;
+}
+
+typedef struct resample_job {
+    simage_buffer *src, *tmp, *dst;
+    uint16_t *wide;
+    resample_axis_t x, y;
+    bool premultiplied;
+    uint32_t unpremultiply[256];
+} resample_job_t;
+
+static void resample_rows_h(void *userdata, int begin, int end) {
+    resample_job_t *job = (resample_job_t*)userdata;
+    int taps = job->x.taps, width = job->tmp->width;
+    for (int y = begin; y < end; y++) {
+        const uint32_t *row = simage_row_ptr(job->src, y);
+        uint32_t *out = simage_row_ptr(job->tmp, y);
+        for (int i = 0; i < width; i++) {
+            const uint32_t *p = row + job->x.first[i];
+            if (job->x.wide) {
+                out[i] = filter_wide(p, 1, job->x.wide + (size_t)i * taps, taps, job->x.bits);
+                continue;
+            }
+            const int16_t *w = job->x.weights + (size_t)i * taps;
+            int t = 0;
+#if defined(SIMAGE_SSE2)
+            const __m128i zero = _mm_setzero_si128();
+            __m128i acc = zero;
+            for (; t + 2 <= taps; t += 2) {
+                __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + t)), zero);
+                px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(weight_pair(w[t], w[t + 1]))));
+            }
+            if (t < taps) {
+                __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p[t]), zero), zero);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(weight_pair(w[t], 0))));
+            }
+            acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(1 << (_FILTER_BITS - 1))), _FILTER_BITS);
+            acc = _mm_packs_epi32(acc, acc);
+            out[i] = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+#elif defined(SIMAGE_NEON)
+            int32x4_t acc = vdupq_n_s32(0);
+            for (; t < taps; t++) {
+                int16x8_t px = vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(p[t]))));
+                acc = vmlal_n_s16(acc, vget_low_s16(px), w[t]);
+            }
+            uint8x8_t c = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(acc, _FILTER_BITS), vdup_n_u16(0)));
+            out[i] = vget_lane_u32(vreinterpret_u32_u8(c), 0);
+#else
+            int32_t acc[4] = {0};
+            for (; t < taps; t++)
+                for (int c = 0; c < 4; c++)
+                    acc[c] += (int32_t)((p[t] >> (c * 8)) & 0xFF) * w[t];
+            out[i] = clamp_channel(acc[0]) | clamp_channel(acc[1]) << 8 | clamp_channel(acc[2]) << 16 | clamp_channel(acc[3]) << 24;
+#endif
+        }
+    }
+}
+
+static void resample_rows_v(void *userdata, int begin, int end) {
+    resample_job_t *job = (resample_job_t*)userdata;
+    int taps = job->y.taps, width = job->dst->width;
+    for (int y = begin; y < end; y++) {
+        const uint32_t *rows = simage_row_ptr(job->tmp, job->y.first[y]);
+        // Wide filters have no 16 bit weights and finish every pixel in their own loop
+        const int16_t *w = job->y.wide ? NULL : job->y.weights + (size_t)y * taps;
+        uint32_t *out = simage_row_ptr(job->dst, y);
+        int i = 0;
+        if (job->y.wide)
+            for (; i < width; i++)
+                out[i] = filter_wide(rows + i, width, job->y.wide + (size_t)y * taps, taps, job->y.bits);
+#if defined(SIMAGE_SSE2)
+        const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi32(1 << (_FILTER_BITS - 1));
+        for (; i + 4 <= width; i += 4) {
+            __m128i acc[4] = { half, half, half, half };
+            for (int t = 0; t < taps; t += 2) {
+                __m128i r0 = _mm_loadu_si128((const __m128i*)(rows + (size_t)t * width + i));
+                __m128i r1 = t + 1 < taps ? _mm_loadu_si128((const __m128i*)(rows + (size_t)(t + 1) * width + i)) : zero;
+                __m128i wt = _mm_set1_epi32(weight_pair(w[t], t + 1 < taps ? w[t + 1] : 0));
+                __m128i a = _mm_unpacklo_epi8(r0, zero), b = _mm_unpacklo_epi8(r1, zero);
+                acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wt));
+                acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wt));
+                a = _mm_unpackhi_epi8(r0, zero);
+                b = _mm_unpackhi_epi8(r1, zero);
+                acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wt));
+                acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wt));
+            }
+            __m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc[0], _FILTER_BITS), _mm_srai_epi32(acc[1], _FILTER_BITS));
+            __m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc[2], _FILTER_BITS), _mm_srai_epi32(acc[3], _FILTER_BITS));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+        }
+#elif defined(SIMAGE_NEON)
+        for (; i + 4 <= width; i += 4) {
+            int32x4_t acc[4] = { vdupq_n_s32(0), vdupq_n_s32(0), vdupq_n_s32(0), vdupq_n_s32(0) };
+            for (int t = 0; t < taps; t++) {
+                uint8x16_t r = vld1q_u8((const uint8_t*)(rows + (size_t)t * width + i));
+                int16x8_t a = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(r)));
+                int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(r)));
+                acc[0] = vmlal_n_s16(acc[0], vget_low_s16(a), w[t]);
+                acc[1] = vmlal_n_s16(acc[1], vget_high_s16(a), w[t]);
+                acc[2] = vmlal_n_s16(acc[2], vget_low_s16(b), w[t]);
+                acc[3] = vmlal_n_s16(acc[3], vget_high_s16(b), w[t]);
+            }
+            uint8x8_t lo = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(acc[0], _FILTER_BITS), vqrshrun_n_s32(acc[1], _FILTER_BITS)));
+            uint8x8_t hi = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(acc[2], _FILTER_BITS), vqrshrun_n_s32(acc[3], _FILTER_BITS)));
+            vst1q_u8((uint8_t*)(out + i), vcombine_u8(lo, hi));
+        }
+#endif
+        for (; i < width; i++) {
+            int32_t acc[4] = {0};
+            for (int t = 0; t < taps; t++) {
+                uint32_t p = rows[(size_t)t * width + i];
+                for (int c = 0; c < 4; c++)
+                    acc[c] += (int32_t)((p >> (c * 8)) & 0xFF) * w[t];
+            }
+            out[i] = clamp_channel(acc[0]) | clamp_channel(acc[1]) << 8 | clamp_channel(acc[2]) << 16 | clamp_channel(acc[3]) << 24;
+        }
+        if (job->premultiplied)
+            for (i = 0; i < width; i++)
+                out[i] = unpremultiply(out[i], job->unpremultiply);
+    }
+}
+
+// Linear light variants, the intermediate keeps 4 x 12 bit channels per pixel in 16 bit lanes
+static void resample_rows_h_linear(void *userdata, int begin, int end) {
+    resample_job_t *job = (resample_job_t*)userdata;
+    int taps = job->x.taps, width = job->dst->width;
+    for (int y = begin; y < end; y++) {
+        const uint32_t *row = simage_row_ptr(job->src, y);
+        uint16_t *out = job->wide + (size_t)y * width * 4;
+        for (int i = 0; i < width; i++, out += 4) {
+            const uint32_t *p = row + job->x.first[i];
+            int64_t acc[4] = {0};
+            int32_t v[4];
+            for (int t = 0; t < taps; t++) {
+                decode_linear(p[t], v);
+                if (job->premultiplied)
+                    for (int c = 1; c < 4; c++)
+                        v[c] = (v[c] * v[0] + _LINEAR_MAX / 2) / _LINEAR_MAX;
+                int32_t w = axis_weight(&job->x, i, t);
+                for (int c = 0; c < 4; c++)
+                    acc[c] += (int64_t)v[c] * w;
+            }
+            for (int c = 0; c < 4; c++)
+                out[c] = (uint16_t)_CLAMP((acc[c] + ((int64_t)1 << (job->x.bits - 1))) >> job->x.bits, 0, _LINEAR_MAX);
+        }
+    }
+}
+
+static void resample_rows_v_linear(void *userdata, int begin, int end) {
+    resample_job_t *job = (resample_job_t*)userdata;
+    int taps = job->y.taps, width = job->dst->width;
+    size_t stride = (size_t)width * 4;
+    for (int y = begin; y < end; y++) {
+        const uint16_t *rows = job->wide + job->y.first[y] * stride;
+        uint32_t *out = simage_row_ptr(job->dst, y);
+        for (int i = 0; i < width; i++) {
+            int64_t acc[4] = {0};
+            int32_t v[4];
+            for (int t = 0; t < taps; t++) {
+                int32_t w = axis_weight(&job->y, y, t);
+                for (int c = 0; c < 4; c++)
+                    acc[c] += (int64_t)rows[t * stride + i * 4 + c] * w;
+            }
+            for (int c = 0; c < 4; c++)
+                v[c] = (int32_t)_CLAMP((acc[c] + ((int64_t)1 << (job->y.bits - 1))) >> job->y.bits, 0, _LINEAR_MAX);
+            if (job->premultiplied)
+                for (int c = 1; c < 4; c++)
+                    v[c] = v[0] ? (v[c] * _LINEAR_MAX + v[0] / 2) / v[0] : 0;
+            out[i] = encode_linear(v);
+        }
+    }
+}
+
+static bool resample(simage_buffer *src, int nw, int nh, simage_filter filter, bool linear, simage_buffer *dst) {
+    if (!src->buffer || nw <= 0 || nh <= 0)
+        return false;
+    bool result = false;
+    simage_buffer tmp = {0}, premultiplied = {0};
+    resample_job_t job = { .src = src, .tmp = &tmp, .dst = dst, .premultiplied = is_translucent(src) };
+    if (!build_resample_axis(src->width, nw, filter, &job.x))
+        return false;
+    if (!build_resample_axis(src->height, nh, filter, &job.y))
+        goto BAIL;
+    // The linear light passes premultiply as they decode
+    if (job.premultiplied && !linear) {
+        if (!simage_dupe(src, &premultiplied))
+            goto BAIL;
+        parallel_for(src->height, (size_t)src->width * src->height, premultiply_rows, &premultiplied);
+        job.src = &premultiplied;
+        for (int a = 1; a < 256; a++)
+            job.unpremultiply[a] = (255u << 16) / a;
+    }
+    if (linear) {
+        init_srgb_tables();
+        if (!(job.wide = malloc((size_t)nw * src->height * 4 * sizeof(uint16_t))))
+            goto BAIL;
+    } else if (!simage_empty(nw, src->height, sg_black, &tmp))
+        goto BAIL;
+    if (!simage_empty(nw, nh, sg_black, dst))
+        goto BAIL;
+    parallel_for(src->height, (size_t)nw * src->height * job.x.taps / 4, linear ? resample_rows_h_linear : resample_rows_h, &job);
+    parallel_for(nh, (size_t)nw * nh * job.y.taps / 4, linear ? resample_rows_v_linear : resample_rows_v, &job);
+    result = true;
+BAIL:
+    simage_destroy_buffer(&tmp);
+    simage_destroy_buffer(&premultiplied);
+    free(job.wide);
+    free_resample_axis(&job.x);
+    free_resample_axis(&job.y);
+    return result;
+}
+
+bool simage_resized_ex(simage_buffer *src, int nw, int nh, simage_filter filter, simage_buffer *dst) {
+    if (filter == SIMAGE_FILTER_NEAREST)
+        return simage_resized(src, nw, nh, dst);
+    if (filter == SIMAGE_FILTER_AREA && src->buffer && nw > 0 && nh > 0 && src->width >= (unsigned int)nw && src->height >= (unsigned int)nh) {
+        if (!simage_empty(nw, nh, sg_black, dst))
+            return false;
+        if (area_resize(src, dst, linear_light))
+            return true;
+        simage_destroy_buffer(dst);
+        return false;
+    }
+    return resample(src, nw, nh, filter, linear_light, dst);
+}
+
+typedef struct halve_job {
+    simage_buffer *src, *dst;
+    bool gamma_correct;
+} halve_job_t;
+
+// 2x2 box average with rounding, odd trailing rows/columns of the source are dropped
+static void halve_rows(void *userdata, int begin, int end) {
+    halve_job_t *job = (halve_job_t*)userdata;
+    int w = job->dst->width, sw = job->src->width;
+    for (int y = begin; y < end; y++) {
+        const uint32_t *r0 = simage_row_ptr(job->src, _MIN(y * 2, (int)job->src->height - 1));
+        const uint32_t *r1 = simage_row_ptr(job->src, _MIN(y * 2 + 1, (int)job->src->height - 1));
+        uint32_t *out = simage_row_ptr(job->dst, y);
+        int x = 0;
+        if (job->gamma_correct) {
+            for (; x < w; x++) {
+                int a = _MIN(x * 2, sw - 1), b = _MIN(x * 2 + 1, sw - 1);
+                uint32_t p[4] = { r0[a], r0[b], r1[a], r1[b] }, c = (p[0] & 0xFF) + (p[1] & 0xFF) + (p[2] & 0xFF) + (p[3] & 0xFF);
+                uint32_t result = (c + 2) >> 2;
+                for (int i = 8; i < 32; i += 8) {
+                    c = 0;
+                    for (int j = 0; j < 4; j++)
+                        c += srgb_to_linear[(p[j] >> i) & 0xFF];
+                    result |= (uint32_t)linear_to_srgb[(c + 2) >> 2] << i;
+                }
+                out[x] = result;
+            }
+            continue;
+        }
+        const uint32_t *rows[2] = { r0, r1 };
+        x = _MIN(w, sw / 2);
+        box_span(rows, 1, out, x);
+        for (; x < w; x++) {
+            int a = _MIN(x * 2, sw - 1), b = _MIN(x * 2 + 1, sw - 1);
+            uint32_t result = 0;
+            for (int i = 0; i < 32; i += 8)
+                result |= ((((r0[a] >> i) & 0xFF) + ((r0[b] >> i) & 0xFF) + ((r1[a] >> i) & 0xFF) + ((r1[b] >> i) & 0xFF) + 2) >> 2) << i;
+            out[x] = result;
+        }
+    }
+}
+
+int simage_build_mips(simage_buffer *src, simage_filter filter, bool gamma_correct, simage_buffer *out_levels) {
+    if (!src->buffer || !simage_dupe(src, &out_levels[0]))
+        return 0;
+    if (gamma_correct)
+        init_srgb_tables();
+    if (filter == SIMAGE_FILTER_NEAREST)
+        filter = SIMAGE_FILTER_BOX;
+    int count = 1;
+    while (count < SG_MAX_MIPMAPS) {
+        simage_buffer *prev = &out_levels[count - 1];
+        if (prev->width == 1 && prev->height == 1)
+            break;
+        int w = _MAX(prev->width >> 1, 1), h = _MAX(prev->height >> 1, 1);
+        if (filter == SIMAGE_FILTER_BOX) {
+            if (!simage_empty(w, h, sg_black, &out_levels[count]))
+                break;
+            halve_job_t job = { .src = prev, .dst = &out_levels[count], .gamma_correct = gamma_correct };
+            parallel_for(h, (size_t)w * h * 4, halve_rows, &job);
+        } else if (!resample(prev, w, h, filter, gamma_correct, &out_levels[count]))
+            break;
+        count++;
+    }
+    return count;
+}
+
+#define _TRANSPOSE_TILE 64
+
+typedef struct quarter_job {
+    simage_buffer *src, *dst;
+    bool clockwise;
+} quarter_job_t;
+
+/* Transposes a 4x4 block, dst rows are the src columns. reverse flips each dst row, which
+   together with the transpose gives a clockwise quarter turn */
+static inline void transpose4(const uint32_t *s, size_t ss, uint32_t *d, ptrdiff_t ds, bool reverse) {
+#if defined(SIMAGE_SSE2)
+    __m128i a = _mm_loadu_si128((const __m128i*)s), b = _mm_loadu_si128((const __m128i*)(s + ss));
+    __m128i c = _mm_loadu_si128((const __m128i*)(s + ss * 2)), e = _mm_loadu_si128((const __m128i*)(s + ss * 3));
+    __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, e);
+    __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, e);
+    __m128i r[4] = {
+        _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+        _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)
+    };
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i*)(d + ds * i), reverse ? _mm_shuffle_epi32(r[i], _MM_SHUFFLE(0, 1, 2, 3)) : r[i]);
+#else
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            d[ds * i + (reverse ? 3 - j : j)] = s[ss * j + i];
+#endif
+}
+
+// Works through bands of source rows in square tiles so both sides stay in cache
+static void quarter_rows(void *userdata, int begin, int end) {
+    quarter_job_t *job = (quarter_job_t*)userdata;
+    int w = job->src->width, h = job->src->height;
+    size_t ss = w;
+    for (int ty = begin * _TRANSPOSE_TILE; ty < _MIN(end * _TRANSPOSE_TILE, h); ty += _TRANSPOSE_TILE)
+        for (int tx = 0; tx < w; tx += _TRANSPOSE_TILE) {
+            int y1 = _MIN(ty + _TRANSPOSE_TILE, h), x1 = _MIN(tx + _TRANSPOSE_TILE, w);
+            for (int y = ty; y < y1; y += 4)
+                for (int x = tx; x < x1; x += 4) {
+                    const uint32_t *s = simage_row_ptr(job->src, y) + x;
+                    if (y + 4 <= y1 && x + 4 <= x1) {
+                        // clockwise: dst(H-1-y, x) = src(x, y), counter clockwise: dst(y, W-1-x) = src(x, y)
+                        if (job->clockwise)
+                            transpose4(s, ss, simage_row_ptr(job->dst, x) + h - 4 - y, h, true);
+                        else
+                            transpose4(s, ss, simage_row_ptr(job->dst, w - 1 - x) + y, -(ptrdiff_t)h, false);
+                        continue;
+                    }
+                    for (int j = 0; j < _MIN(4, y1 - y); j++)
+                        for (int i = 0; i < _MIN(4, x1 - x); i++) {
+                            if (job->clockwise)
+                                simage_row_ptr(job->dst, x + i)[h - 1 - y - j] = s[ss * j + i];
+                            else
+                                simage_row_ptr(job->dst, w - 1 - x - i)[y + j] = s[ss * j + i];
+                        }
+                }
+        }
+}
+
+static bool rotated_quarter(simage_buffer *src, bool clockwise, simage_buffer *dst) {
+    if (!src->buffer || !alloc_buffer(src->height, src->width, dst))
+        return false;
+    quarter_job_t job = { .src = src, .dst = dst, .clockwise = clockwise };
+    parallel_for((src->height + _TRANSPOSE_TILE - 1) / _TRANSPOSE_TILE, (size_t)src->width * src->height, quarter_rows, &job);
+    return true;
+}
+
+bool simage_rotated90(simage_buffer *src, simage_buffer *dst) {
+    return rotated_quarter(src, true, dst);
+}
+
+bool simage_rotated270(simage_buffer *src, simage_buffer *dst) {
+    return rotated_quarter(src, false, dst);
+}
+
+/* Writes a reversed into b and b reversed into a, a and b may be the same row in which
+   case it is reversed in place */
+static void reverse_swap(uint32_t *a, uint32_t *b, int n) {
+    int i = 0, j = n - 1;
+    bool same = a == b;
+#if defined(SIMAGE_SSE2)
+    for (; same ? i + 4 <= j - 3 : i + 4 <= n; i += 4, j -= 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i)), vb = _mm_loadu_si128((const __m128i*)(b + j - 3));
+        _mm_storeu_si128((__m128i*)(a + i), _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 1, 2, 3)));
+        _mm_storeu_si128((__m128i*)(b + j - 3), _mm_shuffle_epi32(va, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for (; same ? i < j : i < n; i++, j--) {
+        uint32_t t = a[i];
+        a[i] = b[j];
+        b[j] = t;
+    }
+}
+
+static void reverse_copy(uint32_t *d, const uint32_t *s, int n) {
+    int i = 0;
+#if defined(SIMAGE_SSE2)
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i*)(d + i), _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(s + n - 4 - i)), _MM_SHUFFLE(0, 1, 2, 3)));
+#endif
+    for (; i < n; i++)
+        d[i] = s[n - 1 - i];
+}
+
+typedef struct mirror_job {
+    simage_buffer *src, *dst;
+    bool horizontal, vertical;
+} mirror_job_t;
+
+static void mirror_rows(void *userdata, int begin, int end) {
+    mirror_job_t *job = (mirror_job_t*)userdata;
+    int w = job->src->width, h = job->src->height;
+    uint32_t tmp[256];
+    for (int y = begin; y < end; y++) {
+        uint32_t *a = simage_row_ptr(job->dst, y);
+        uint32_t *b = simage_row_ptr(job->src, job->vertical ? h - 1 - y : y);
+        if (job->src != job->dst) {
+            if (job->horizontal)
+                reverse_copy(a, b, w);
+            else
+                memcpy(a, b, w * sizeof(uint32_t));
+        } else if (job->horizontal)
+            reverse_swap(a, b, w);
+        else
+            for (int x = 0; x < w; x += 256) {
+                int n = _MIN(256, w - x);
+                memcpy(tmp, a + x, n * sizeof(uint32_t));
+                memcpy(a + x, b + x, n * sizeof(uint32_t));
+                memcpy(b + x, tmp, n * sizeof(uint32_t));
+            }
+    }
+}
+
+// In place the rows are swapped in pairs, so only the top half (and a middle row) is walked
+static void mirror(simage_buffer *src, simage_buffer *dst, bool horizontal, bool vertical) {
+    mirror_job_t job = { .src = src, .dst = dst, .horizontal = horizontal, .vertical = vertical };
+    int rows = src == dst && vertical ? (src->height + (horizontal ? 1 : 0)) / 2 : src->height;
+    parallel_for(rows, (size_t)src->width * src->height, mirror_rows, &job);
+}
+
+bool simage_rotated180(simage_buffer *src, simage_buffer *dst) {
+    if (!src->buffer || !alloc_buffer(src->width, src->height, dst))
+        return false;
+    mirror(src, dst, true, true);
+    return true;
+}
+
+void simage_rotate90(simage_buffer *img) {
+    simage_buffer result;
+    if (!simage_rotated90(img, &result))
+        return;
+    free(img->buffer);
+    memcpy(img, &result, sizeof(simage_buffer));
+}
+
+void simage_rotate180(simage_buffer *img) {
+    if (img->buffer)
+        mirror(img, img, true, true);
+}
+
+void simage_rotate270(simage_buffer *img) {
+    simage_buffer result;
+    if (!simage_rotated270(img, &result))
+        return;
+    free(img->buffer);
+    memcpy(img, &result, sizeof(simage_buffer));
+}
+
+void simage_flip_h(simage_buffer *img) {
+    if (img->buffer)
+        mirror(img, img, true, false);
+}
+
+void simage_flip_v(simage_buffer *img) {
+    if (img->buffer)
+        mirror(img, img, false, true);
+}
+
+/* Geometric transforms map every destination pixel center back into the source with a 2x3
+   matrix. Positions are stepped along each destination row in 48.16 fixed point, the row is
+   split into the span whose whole filter footprint is inside the source (sampled without any
+   tests) and the border spans, which clamp or wrap their taps */
+#define _WARP_BITS 16
+#define _WARP_ONE ((int64_t)1 << _WARP_BITS)
+
+typedef struct warp_job {
+    simage_buffer *src, *dst;
+    simage_filter filter;
+    simage_edge_mode edge;
+    bool perspective;
+    double m[9];
+    int16_t cubic[256][4];
+} warp_job_t;
+
+static inline int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Narrows [x0, x1) to the x where lo <= (p + x * dp) >> _WARP_BITS <= hi
+static void clip_span(int64_t p, int64_t dp, int64_t lo, int64_t hi, int *x0, int *x1) {
+    int64_t a = lo * _WARP_ONE, b = (hi + 1) * _WARP_ONE - 1, first, last;
+    if (dp == 0) {
+        if (p < a || p > b)
+            *x1 = *x0;
+        return;
+    }
+    if (dp > 0) {
+        first = -floor_div(p - a, dp);
+        last = floor_div(b - p, dp);
+    } else {
+        first = -floor_div(b - p, -dp);
+        last = floor_div(p - a, -dp);
+    }
+    // Clamped before narrowing, nearly flat steps put the bounds far outside the span
+    int lo0 = *x0, hi1 = *x1;
+    *x0 = (int)_CLAMP(first, (int64_t)lo0, (int64_t)hi1);
+    *x1 = (int)_CLAMP(last + 1, (int64_t)*x0, (int64_t)hi1);
+}
+
+// 2x2 pixels, p0/p1 hold the left and right pixel of each row in their low 64 bits, fx/fy are 7 bit
+static inline uint32_t bilerp(uint64_t p0, uint64_t p1, int fx, int fy) {
+#if defined(SIMAGE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&p0), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&p1), zero);
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(a, _mm_set1_epi16((short)(128 - fy))), _mm_mullo_epi16(b, _mm_set1_epi16((short)fy)));
+    c = _mm_srli_epi16(_mm_add_epi16(c, _mm_set1_epi16(64)), 7);
+    c = _mm_mullo_epi16(c, _mm_set_epi16(fx, fx, fx, fx, 128 - fx, 128 - fx, 128 - fx, 128 - fx));
+    c = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(c, _mm_srli_si128(c, 8)), _mm_set1_epi16(64)), 7);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(c, c));
+#else
+    uint32_t out = 0;
+    for (int i = 0; i < 32; i += 8) {
+        uint32_t l = ((((p0 >> i) & 0xFF) * (128 - fy) + ((p1 >> i) & 0xFF) * fy) + 64) >> 7;
+        uint32_t r = ((((p0 >> (i + 32)) & 0xFF) * (128 - fy) + ((p1 >> (i + 32)) & 0xFF) * fy) + 64) >> 7;
+        out |= ((l * (128 - fx) + r * fx + 64) >> 7) << i;
+    }
+    return out;
+#endif
+}
+
+// 4x4 Catmull-Rom, wx/wy are _FILTER_BITS weights
+static inline uint32_t bicubic(const uint32_t *p, size_t stride, const int16_t *wx, const int16_t *wy) {
+#if defined(SIMAGE_SSE2)
+    const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi32(1 << (_FILTER_BITS - 1));
+    const __m128i w01 = _mm_set1_epi32(weight_pair(wx[0], wx[1])), w23 = _mm_set1_epi32(weight_pair(wx[2], wx[3]));
+    __m128i rows[4];
+    for (int j = 0; j < 4; j++) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(p + stride * j));
+        __m128i lo = _mm_unpacklo_epi8(px, zero), hi = _mm_unpackhi_epi8(px, zero);
+        lo = _mm_madd_epi16(_mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8)), w01);
+        hi = _mm_madd_epi16(_mm_unpacklo_epi16(hi, _mm_srli_si128(hi, 8)), w23);
+        rows[j] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(lo, hi), half), _FILTER_BITS);
+    }
+    __m128i a = _mm_packs_epi32(rows[0], rows[1]), b = _mm_packs_epi32(rows[2], rows[3]);
+    a = _mm_madd_epi16(_mm_unpacklo_epi16(a, _mm_srli_si128(a, 8)), _mm_set1_epi32(weight_pair(wy[0], wy[1])));
+    b = _mm_madd_epi16(_mm_unpacklo_epi16(b, _mm_srli_si128(b, 8)), _mm_set1_epi32(weight_pair(wy[2], wy[3])));
+    a = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(a, b), half), _FILTER_BITS);
+    a = _mm_packs_epi32(a, a);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(a, a));
+#else
+    uint32_t out = 0;
+    for (int c = 0; c < 32; c += 8) {
+        int32_t acc = 0;
+        for (int j = 0; j < 4; j++) {
+            int32_t row = 0;
+            for (int i = 0; i < 4; i++)
+                row += (int32_t)((p[stride * j + i] >> c) & 0xFF) * wx[i];
+            acc += ((row + (1 << (_FILTER_BITS - 1))) >> _FILTER_BITS) * wy[j];
+        }
+        out |= clamp_channel(acc) << c;
+    }
+    return out;
+#endif
+}
+
+static inline int edge_index(int64_t i, int n, simage_edge_mode edge) {
+    if (edge == SIMAGE_EDGE_WRAP)
+        return (int)(((i % n) + n) % n);
+    return (int)_CLAMP(i, 0, (int64_t)n - 1);
+}
+
+static inline uint32_t warp_sample(warp_job_t *job, int64_t u, int64_t v, bool clamped) {
+    simage_buffer *src = job->src;
+    int w = src->width, h = src->height;
+    int64_t x = u >> _WARP_BITS, y = v >> _WARP_BITS;
+    simage_edge_mode edge = job->edge == SIMAGE_EDGE_WRAP ? SIMAGE_EDGE_WRAP : SIMAGE_EDGE_CLAMP;
+    switch (job->filter) {
+        case SIMAGE_FILTER_NEAREST:
+            if (!clamped)
+                return simage_row_ptr(src, (int)y)[x];
+            return simage_row_ptr(src, edge_index(y, h, edge))[edge_index(x, w, edge)];
+        case SIMAGE_FILTER_BILINEAR: {
+            int fx = (int)(u >> (_WARP_BITS - 7)) & 127, fy = (int)(v >> (_WARP_BITS - 7)) & 127;
+            if (!clamped) {
+                const uint32_t *p = simage_row_ptr(src, (int)y) + x;
+                uint64_t p0, p1;
+                memcpy(&p0, p, sizeof(uint64_t));
+                memcpy(&p1, p + w, sizeof(uint64_t));
+                return bilerp(p0, p1, fx, fy);
+            }
+            int x0 = edge_index(x, w, edge), x1 = edge_index(x + 1, w, edge);
+            const uint32_t *r0 = simage_row_ptr(src, edge_index(y, h, edge)), *r1 = simage_row_ptr(src, edge_index(y + 1, h, edge));
+            return bilerp((uint64_t)r0[x1] << 32 | r0[x0], (uint64_t)r1[x1] << 32 | r1[x0], fx, fy);
+        }
+        default: {
+            const int16_t *wx = job->cubic[(u >> (_WARP_BITS - 8)) & 255], *wy = job->cubic[(v >> (_WARP_BITS - 8)) & 255];
+            if (!clamped)
+                return bicubic(simage_row_ptr(src, (int)y - 1) + x - 1, w, wx, wy);
+            uint32_t p[16];
+            for (int j = 0; j < 4; j++) {
+                const uint32_t *row = simage_row_ptr(src, edge_index(y - 1 + j, h, edge));
+                for (int i = 0; i < 4; i++)
+                    p[j * 4 + i] = row[edge_index(x - 1 + i, w, edge)];
+            }
+            return bicubic(p, 4, wx, wy);
+        }
+    }
+}
+
+/* Samples out[0, n) of a destination row where the source position is affine in x, u and v
+   are the (offset) position of out[0]. Callers keep the positions of the whole span within
+   _WARP_LIMIT so stepping them can't overflow */
+static void warp_span(warp_job_t *job, uint32_t *out, int n, int64_t u, int64_t v, int64_t du, int64_t dv) {
+    int w = job->src->width, h = job->src->height;
+    int64_t center = job->filter == SIMAGE_FILTER_NEAREST ? 0 : _WARP_ONE / 2;
+    // Interpolating filters reach `lo` pixels left/up and `hi` pixels right/down of the integer position
+    int lo = job->filter == SIMAGE_FILTER_BICUBIC ? 1 : 0;
+    int hi = job->filter == SIMAGE_FILTER_NEAREST ? 0 : lo + 1;
+    int o0 = 0, o1 = n;
+    if (job->edge == SIMAGE_EDGE_NONE) {
+        clip_span(u + center, du, 0, w - 1, &o0, &o1);
+        clip_span(v + center, dv, 0, h - 1, &o0, &o1);
+    }
+    int i0 = o0, i1 = o1;
+    clip_span(u, du, lo, w - 1 - hi, &i0, &i1);
+    clip_span(v, dv, lo, h - 1 - hi, &i0, &i1);
+    if (i0 == i1)
+        i0 = i1 = o1;
+    int x = o0;
+    int64_t pu = u + du * x, pv = v + dv * x;
+    for (; x < i0; x++, pu += du, pv += dv)
+        out[x] = warp_sample(job, pu, pv, true);
+    switch (job->filter) {
+        case SIMAGE_FILTER_NEAREST:
+            for (; x < i1; x++, pu += du, pv += dv)
+                out[x] = simage_row_ptr(job->src, (int)(pv >> _WARP_BITS))[pu >> _WARP_BITS];
+            break;
+        default:
+            for (; x < i1; x++, pu += du, pv += dv)
+                out[x] = warp_sample(job, pu, pv, false);
+            break;
+    }
+    for (; x < o1; x++, pu += du, pv += dv)
+        out[x] = warp_sample(job, pu, pv, true);
+}
+
+// Perspective rows are split into segments that are interpolated linearly between exact ends
+#define _WARP_SEGMENT 16
+// Furthest source position that is sampled, pixels mapping further out are left untouched
+#define _WARP_LIMIT 1e12
+
+static inline bool warp_in_range(double u, double v) {
+    return fabs(u) <= _WARP_LIMIT && fabs(v) <= _WARP_LIMIT;
+}
+
+// Projects and samples a single destination pixel
+static void warp_pixel(warp_job_t *job, uint32_t *out, int x, double cy, double offset) {
+    const double *m = job->m;
+    double cx = x + .5, q = job->perspective ? m[6] * cx + m[7] * cy + m[8] : 1.;
+    if (q <= 1e-9)
+        return;
+    double su = (m[0] * cx + m[1] * cy + m[2]) / q - offset, sv = (m[3] * cx + m[4] * cy + m[5]) / q - offset;
+    if (warp_in_range(su, sv))
+        warp_span(job, out + x, 1, llround(su * _WARP_ONE), llround(sv * _WARP_ONE), 0, 0);
+}
+
+static void warp_rows(void *userdata, int begin, int end) {
+    warp_job_t *job = (warp_job_t*)userdata;
+    const double *m = job->m;
+    double offset = job->filter == SIMAGE_FILTER_NEAREST ? 0. : .5;
+    int dw = job->dst->width;
+    for (int y = begin; y < end; y++) {
+        uint32_t *out = simage_row_ptr(job->dst, y);
+        double cy = y + .5;
+        if (!job->perspective) {
+            double u = m[0] * .5 + m[1] * cy + m[2] - offset, v = m[3] * .5 + m[4] * cy + m[5] - offset;
+            if (warp_in_range(u, v) && warp_in_range(u + m[0] * dw, v + m[3] * dw))
+                warp_span(job, out, dw, llround(u * _WARP_ONE), llround(v * _WARP_ONE), llround(m[0] * _WARP_ONE), llround(m[3] * _WARP_ONE));
+            else
+                for (int x = 0; x < dw; x++)
+                    warp_pixel(job, out, x, cy, offset);
+            continue;
+        }
+        for (int x0 = 0; x0 < dw; x0 += _WARP_SEGMENT) {
+            int x1 = _MIN(x0 + _WARP_SEGMENT, dw), n = x1 - x0;
+            double a = x0 + .5, b = x1 - .5;
+            double wa = m[6] * a + m[7] * cy + m[8], wb = m[6] * b + m[7] * cy + m[8];
+            double ua = (m[0] * a + m[1] * cy + m[2]) / wa - offset, ub = (m[0] * b + m[1] * cy + m[2]) / wb - offset;
+            double va = (m[3] * a + m[4] * cy + m[5]) / wa - offset, vb = (m[3] * b + m[4] * cy + m[5]) / wb - offset;
+            // Segments crossing the horizon or reaching too far out project every pixel on its own
+            if (wa <= 1e-9 || wb <= 1e-9 || !warp_in_range(ua, va) || !warp_in_range(ub, vb)) {
+                for (int x = x0; x < x1; x++)
+                    warp_pixel(job, out, x, cy, offset);
+                continue;
+            }
+            int64_t du = n > 1 ? llround((ub - ua) / (n - 1) * _WARP_ONE) : 0, dv = n > 1 ? llround((vb - va) / (n - 1) * _WARP_ONE) : 0;
+            warp_span(job, out + x0, n, llround(ua * _WARP_ONE), llround(va * _WARP_ONE), du, dv);
+        }
+    }
+}
+
+// m maps destination pixel centers to source positions (a 3x3 homography if perspective)
+static void warp(simage_buffer *src, const double *m, bool perspective, simage_filter filter, simage_edge_mode edge, simage_buffer *dst) {
+    warp_job_t job = { .src = src, .dst = dst, .edge = edge, .perspective = perspective };
+    switch (filter) {
+        case SIMAGE_FILTER_NEAREST:
+        case SIMAGE_FILTER_BILINEAR:
+            job.filter = filter;
+            break;
+        case SIMAGE_FILTER_BOX:
+        case SIMAGE_FILTER_AREA:
+            job.filter = SIMAGE_FILTER_BILINEAR;
+            break;
+        default:
+            job.filter = SIMAGE_FILTER_BICUBIC;
+            for (int i = 0; i < 256; i++) {
+                float t = i / 256.f;
+                int total = 0, largest = 0;
+                for (int k = 0; k < 4; k++) {
+                    job.cubic[i][k] = (int16_t)lroundf(filter_weight(SIMAGE_FILTER_BICUBIC, t + 1 - k) * _FILTER_ONE);
+                    total += job.cubic[i][k];
+                    if (job.cubic[i][k] > job.cubic[i][largest])
+                        largest = k;
+                }
+                job.cubic[i][largest] += _FILTER_ONE - total;
+            }
+            break;
+    }
+    memcpy(job.m, m, (perspective ? 9 : 6) * sizeof(double));
+    parallel_for(dst->height, (size_t)dst->width * dst->height * (job.filter == SIMAGE_FILTER_BICUBIC ? 4 : 1), warp_rows, &job);
+}
+
+bool simage_warp_affine(simage_buffer *src, const float m[6], int dw, int dh, simage_filter filter, simage_edge_mode edge, simage_buffer *dst) {
+    double det = (double)m[0] * m[4] - (double)m[1] * m[3];
+    if (!src->buffer || fabs(det) < 1e-12 || dw <= 0 || dh <= 0)
+        return false;
+    if (!simage_empty(dw, dh, (sg_color){0}, dst))
+        return false;
+    double inv[6] = {
+         m[4] / det, -m[1] / det, 0.,
+        -m[3] / det,  m[0] / det, 0.
+    };
+    inv[2] = -(inv[0] * m[2] + inv[1] * m[5]);
+    inv[5] = -(inv[3] * m[2] + inv[4] * m[5]);
+    warp(src, inv, false, filter, edge, dst);
+    return true;
+}
+
+bool simage_warp_perspective(simage_buffer *src, const float m[9], int dw, int dh, simage_filter filter, simage_edge_mode edge, simage_buffer *dst) {
+    // Points in front of the projection have a positive w, so keep the source origin in front
+    double a[9], inv[9], sign = m[8] < 0.f ? -1. : 1.;
+    for (int i = 0; i < 9; i++)
+        a[i] = m[i] * sign;
+    inv[0] = a[4] * a[8] - a[5] * a[7];
+    inv[1] = a[2] * a[7] - a[1] * a[8];
+    inv[2] = a[1] * a[5] - a[2] * a[4];
+    inv[3] = a[5] * a[6] - a[3] * a[8];
+    inv[4] = a[0] * a[8] - a[2] * a[6];
+    inv[5] = a[2] * a[3] - a[0] * a[5];
+    inv[6] = a[3] * a[7] - a[4] * a[6];
+    inv[7] = a[1] * a[6] - a[0] * a[7];
+    inv[8] = a[0] * a[4] - a[1] * a[3];
+    double det = a[0] * inv[0] + a[1] * inv[3] + a[2] * inv[6];
+    if (!src->buffer || fabs(det) < 1e-12 || dw <= 0 || dh <= 0)
+        return false;
+    if (!simage_empty(dw, dh, (sg_color){0}, dst))
+        return false;
+    for (int i = 0; i < 9; i++)
+        inv[i] /= det;
+    warp(src, inv, true, filter, edge, dst);
+    return true;
+}
+
+bool simage_rotated_ex(simage_buffer *src, float angle, simage_filter filter, simage_buffer *dst) {
+    float turns = fmodf(angle, 360.f);
+    if (turns < 0.f)
+        turns += 360.f;
+    if (turns == 0.f)
+        return simage_dupe(src, dst);
+    if (turns == 90.f)
+        return simage_rotated90(src, dst);
+    if (turns == 180.f)
+        return simage_rotated180(src, dst);
+    if (turns == 270.f)
+        return simage_rotated270(src, dst);
+    if (!src->buffer)
+        return false;
+    double theta = angle * 0.017453292519943295, c = cos(theta), s = sin(theta);
+    double w = src->width, h = src->height;
+    int dw = (int)ceil(fabs(w * c) + fabs(h * s) - 1e-6);
+    int dh = (int)ceil(fabs(w * s) + fabs(h * c) - 1e-6);
+    if (!simage_empty(_MAX(dw, 1), _MAX(dh, 1), sg_black, dst))
+        return false;
+    // Rotates around the centers of both images
+    double m[6] = {
+         c, s, w / 2 - c * dst->width / 2 - s * dst->height / 2,
+        -s, c, h / 2 + s * dst->width / 2 - c * dst->height / 2
+    };
+    warp(src, m, false, filter, SIMAGE_EDGE_NONE, dst);
+    return true;
+}
+
+/* Three-shear rotation (Paeth). Each pass shifts whole rows by a fractional amount, so every
+   row is a constant 2-tap filter streamed front to back. The column shear runs on a transposed
+   copy made with the tiled quarter turns */
+typedef struct shear_job {
+    simage_buffer *src, *dst;
+    double shear;
+    uint32_t background;
+} shear_job_t;
+
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t f) {
+    uint32_t out = 0;
+    for (int i = 0; i < 32; i += 8)
+        out |= ((((a >> i) & 0xFF) * (256 - f) + ((b >> i) & 0xFF) * f + 128) >> 8) << i;
+    return out;
+}
+
+static void shear_rows(void *userdata, int begin, int end) {
+    shear_job_t *job = (shear_job_t*)userdata;
+    int wi = job->src->width, wo = job->dst->width, rows = job->src->height;
+    uint32_t bg = job->background;
+    for (int y = begin; y < end; y++) {
+        const uint32_t *in = simage_row_ptr(job->src, y);
+        uint32_t *out = simage_row_ptr(job->dst, y);
+        // out[x] samples the input at x + p, centers of both rows stay aligned
+        double p = -(job->shear * (y + .5 - rows / 2.) + (wo - wi) / 2.);
+        int64_t n = (int64_t)floor(p);
+        uint32_t f = (uint32_t)lround((p - n) * 256);
+        if (f == 256) {
+            n++;
+            f = 0;
+        }
+        int x0 = (int)_CLAMP(-n, 0, (int64_t)wo), x1 = (int)_CLAMP(wi - 1 - n, (int64_t)x0, (int64_t)wo);
+        for (int x = 0; x < x0; x++) {
+            int64_t i = x + n;
+            out[x] = i == -1 ? lerp_pixel(bg, in[0], f) : bg;
+        }
+        int x = x0;
+        const uint32_t *s = in + n;
+#if defined(SIMAGE_SSE2)
+        const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+        const __m128i wa = _mm_set1_epi16((short)(256 - f)), wb = _mm_set1_epi16((short)f);
+        for (; x + 4 <= x1; x += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(s + x)), b = _mm_loadu_si128((const __m128i*)(s + x + 1));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wb));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wb));
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+            _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; x < x1; x++)
+            out[x] = lerp_pixel(s[x], s[x + 1], f);
+        for (; x < wo; x++) {
+            int64_t i = x + n;
+            out[x] = i == wi - 1 ? lerp_pixel(in[wi - 1], bg, f) : bg;
+        }
+    }
+}
+
+static bool shear(simage_buffer *src, double amount, int width, uint32_t background, simage_buffer *dst) {
+    if (!alloc_buffer(width, src->height, dst))
+        return false;
+    shear_job_t job = { .src = src, .dst = dst, .shear = amount, .background = background };
+    parallel_for(src->height, (size_t)width * src->height, shear_rows, &job);
+    return true;
+}
+
+bool simage_rotated_shear(simage_buffer *src, float angle, simage_buffer *dst) {
+    if (!src->buffer)
+        return false;
+    double turns = fmod(angle, 360.);
+    if (turns < 0.)
+        turns += 360.;
+    int quarter = (int)floor(turns / 90. + .5) & 3;
+    double residual = turns - 90. * floor(turns / 90. + .5);
+    if (residual == 0.)
+        return simage_rotated_ex(src, quarter * 90.f, SIMAGE_FILTER_NEAREST, dst);
+    double theta = turns * 0.017453292519943295, w = src->width, h = src->height;
+    int dw = _MAX((int)ceil(fabs(w * cos(theta)) + fabs(h * sin(theta)) - 1e-6), 1);
+    int dh = _MAX((int)ceil(fabs(w * sin(theta)) + fabs(h * cos(theta)) - 1e-6), 1);
+    // Quarter turns are exact, what is left is within +-45 degrees where the shears stay small
+    simage_buffer turned = {0}, a = {0}, b = {0}, c = {0};
+    simage_buffer *base = src;
+    bool result = false;
+    if (quarter) {
+        if (!simage_rotated_ex(src, quarter * 90.f, SIMAGE_FILTER_NEAREST, &turned))
+            return false;
+        base = &turned;
+    }
+    double r = residual * 0.017453292519943295, alpha = -tan(r / 2.), beta = sin(r);
+    const uint32_t background = 0xFF; // sg_black, as simage_rotated fills
+    int w1 = (int)ceil(base->width + fabs(alpha) * base->height - 1e-6);
+    // x += alpha * y, then y += beta * x on the transposed image, then x += alpha * y again
+    if (!shear(base, alpha, w1, background, &a) ||
+        !simage_rotated270(&a, &b))
+        goto BAIL;
+    simage_destroy_buffer(&a);
+    if (!shear(&b, -beta, dh, background, &c))
+        goto BAIL;
+    simage_destroy_buffer(&b);
+    if (!simage_rotated90(&c, &b))
+        goto BAIL;
+    result = shear(&b, alpha, dw, background, dst);
+BAIL:
+    simage_destroy_buffer(&turned);
+    simage_destroy_buffer(&a);
+    simage_destroy_buffer(&b);
+    simage_destroy_buffer(&c);
+    return result;
+}
+
+bool simage_rotated(simage_buffer *src, float angle, simage_buffer *dst) {
+    return simage_rotated_ex(src, angle, SIMAGE_FILTER_NEAREST, dst);
+}
+
+void simage_rotate(simage_buffer *src, float angle) {
+    simage_buffer result;
+    if (!simage_rotated(src, angle, &result))
+        return;
+    free(src->buffer);
+    memcpy(src, &result, sizeof(simage_buffer));
+}
+
+bool simage_clipped(simage_buffer *src, int rx, int ry, int rw, int rh, simage_buffer *dst) {
+    int ox = _CLAMP(rx, 0, src->width);
+    int oy = _CLAMP(ry, 0, src->height);
+    if (ox >= src->width || oy >= src->height)
+        return false;
+    int mx = _MIN(ox + rw, src->width);
+    int my = _MIN(oy + rh, src->height);
+    int iw = mx - ox;
+    int ih = my - oy;
+    if (iw <= 0 || ih <= 0)
+        return false;
+    if (!simage_empty(iw, ih, sg_black, dst))
+        return false;
+    simage_clipped_paste(dst, src, 0, 0, ox, oy, iw, ih);
+    return true;
+}
+
+void simage_clip(simage_buffer *src, int rx, int ry, int rw, int rh) {
+    simage_buffer result;
+    if (!simage_clipped(src, rx, ry, rw, rh, &result))
+        return;
+    free(src->buffer);
+    memcpy(src, &result, sizeof(simage_buffer));
+}
+
+static bool vseek(FILE *fh, uint64_t offset) {
+#ifdef _WIN32
+    return !_fseeki64(fh, (__int64)offset, SEEK_SET);
+#elif (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L) || defined(__APPLE__)
+    return !fseeko(fh, (off_t)offset, SEEK_SET);
+#else
+    // Strict ISO C only has long offsets, reach larger ones in steps
+    if (fseek(fh, 0, SEEK_SET))
+        return false;
+    for (; offset > LONG_MAX; offset -= LONG_MAX)
+        if (fseek(fh, LONG_MAX, SEEK_CUR))
+            return false;
+    return !fseek(fh, (long)offset, SEEK_CUR);
+#endif
+}
+
+typedef struct virtual_tile {
+    int index;
+    bool dirty;
+    uint64_t last_used;
+    int32_t *buffer;
+} virtual_tile_t;
+
+// Resident tiles sit in slots, page maps a tile to its slot (-1 when paged out)
+typedef struct virtual_pager {
+    unsigned int tile_size, tiles_x, tiles_y;
+    int32_t fill;
+    int slot_count;
+    virtual_tile_t *slots;
+    int *page;
+    unsigned char *stored;
+    uint64_t tick;
+    FILE *scratch;
+} virtual_pager_t;
+
+bool simage_virtual_empty(unsigned int w, unsigned int h, sg_color color, unsigned int tile_size, size_t budget, const char *scratch_path, simage_virtual *dst) {
+    memset(dst, 0, sizeof(simage_virtual));
+    if (w <= 0 || h <= 0)
+        return false;
+    virtual_pager_t *vp = calloc(1, sizeof(virtual_pager_t));
+    if (!vp)
+        return false;
+    dst->width = w;
+    dst->height = h;
+    dst->pager = vp;
+    vp->tile_size = tile_size ? tile_size : 256;
+    vp->tiles_x = (w + vp->tile_size - 1) / vp->tile_size;
+    vp->tiles_y = (h + vp->tile_size - 1) / vp->tile_size;
+    vp->fill = sg_color_to_int(color);
+    size_t tile_bytes = (size_t)vp->tile_size * vp->tile_size * sizeof(int32_t);
+    size_t tile_count = (size_t)vp->tiles_x * vp->tiles_y;
+    vp->slot_count = (int)_CLAMP((budget ? budget : 256 << 20) / tile_bytes, 1, tile_count);
+    if (!(vp->scratch = scratch_path ? fopen(scratch_path, "w+b") : tmpfile()))
+        goto BAIL;
+    if (!(vp->slots = calloc(vp->slot_count, sizeof(virtual_tile_t))) ||
+        !(vp->page = malloc(tile_count * sizeof(int))) ||
+        !(vp->stored = calloc(tile_count, 1)))
+        goto BAIL;
+    for (size_t i = 0; i < tile_count; i++)
+        vp->page[i] = -1;
+    for (int i = 0; i < vp->slot_count; i++) {
+        vp->slots[i].index = -1;
+        if (!(vp->slots[i].buffer = malloc(tile_bytes)))
+            goto BAIL;
+    }
+    return true;
+BAIL:
+    simage_virtual_destroy(dst);
+    return false;
+}
+
+void simage_virtual_destroy(simage_virtual *img) {
+    if (!img)
+        return;
+    virtual_pager_t *vp = (virtual_pager_t*)img->pager;
+    if (vp) {
+        if (vp->slots) {
+            for (int i = 0; i < vp->slot_count; i++)
+                if (vp->slots[i].buffer)
+                    free(vp->slots[i].buffer);
+            free(vp->slots);
+        }
+        if (vp->page)
+            free(vp->page);
+        if (vp->stored)
+            free(vp->stored);
+        if (vp->scratch)
+            fclose(vp->scratch);
+        free(vp);
+    }
+    memset(img, 0, sizeof(simage_virtual));
+}
+
+static int32_t* vtile(virtual_pager_t *vp, unsigned int tx, unsigned int ty, bool write) {
+    int index = ty * vp->tiles_x + tx;
+    int slot = vp->page[index];
+    if (slot < 0) {
+        slot = 0;
+        for (int i = 1; i < vp->slot_count && vp->slots[slot].index >= 0; i++)
+            if (vp->slots[i].index < 0 || vp->slots[i].last_used < vp->slots[slot].last_used)
+                slot = i;
+        virtual_tile_t *tile = &vp->slots[slot];
+        size_t tile_pixels = (size_t)vp->tile_size * vp->tile_size;
+        if (tile->index >= 0) {
+            if (tile->dirty) {
+                if (!vseek(vp->scratch, (uint64_t)tile->index * tile_pixels * sizeof(int32_t)) ||
+                    fwrite(tile->buffer, sizeof(int32_t), tile_pixels, vp->scratch) != tile_pixels)
+                    return NULL;
+                vp->stored[tile->index] = 1;
+            }
+            vp->page[tile->index] = -1;
+            tile->index = -1;
+        }
+        if (vp->stored[index]) {
+            if (!vseek(vp->scratch, (uint64_t)index * tile_pixels * sizeof(int32_t)) ||
+                fread(tile->buffer, sizeof(int32_t), tile_pixels, vp->scratch) != tile_pixels)
+                return NULL;
+        } else
+            for (size_t i = 0; i < tile_pixels; i++)
+                tile->buffer[i] = vp->fill;
+        tile->index = index;
+        tile->dirty = false;
+        vp->page[index] = slot;
+    }
+    virtual_tile_t *tile = &vp->slots[slot];
+    tile->last_used = ++vp->tick;
+    if (write)
+        tile->dirty = true;
+    return tile->buffer;
+}
+
+// Fails when a tile can't be paged in, the rest of the span is still transferred
+static bool vspan(simage_virtual *img, unsigned int x, unsigned int y, unsigned int n, int32_t *pixels, bool write) {
+    virtual_pager_t *vp = (virtual_pager_t*)img->pager;
+    unsigned int ts = vp->tile_size;
+    bool ok = true;
+    while (n) {
+        unsigned int ox = x % ts;
+        unsigned int run = _MIN(n, ts - ox);
+        int32_t *tile = vtile(vp, x / ts, y / ts, write);
+        if (tile) {
+            int32_t *row = tile + (y % ts) * ts + ox;
+            if (write)
+                memcpy(row, pixels, run * sizeof(int32_t));
+            else
+                memcpy(pixels, row, run * sizeof(int32_t));
+        } else {
+            if (!write)
+                memset(pixels, 0, run * sizeof(int32_t));
+            ok = false;
+        }
+        x += run;
+        pixels += run;
+        n -= run;
+    }
+    return ok;
+}
+
+// Blends pixels into a span, or fills it with color when pixels is NULL
+static bool vdraw(simage_virtual *img, unsigned int x, unsigned int y, unsigned int n, const int32_t *pixels, uint32_t color, simage_blend_mode mode) {
+    virtual_pager_t *vp = (virtual_pager_t*)img->pager;
+    unsigned int ts = vp->tile_size;
+    bool ok = true;
+    while (n) {
+        unsigned int ox = x % ts;
+        unsigned int run = _MIN(n, ts - ox);
+        int32_t *tile = vtile(vp, x / ts, y / ts, true);
+        if (!tile)
+            ok = false;
+        else if (pixels)
+            blend_row((uint32_t*)tile + (y % ts) * ts + ox, (const uint32_t*)pixels, run, mode);
+        else
+            fill_row((uint32_t*)tile + (y % ts) * ts + ox, run, color, false);
+        x += run;
+        if (pixels)
+            pixels += run;
+        n -= run;
+    }
+    return ok;
+}
+
+static inline bool vpset(simage_virtual *img, int x, int y, uint32_t color) {
+    if (x < 0 || y < 0 || (unsigned int)x >= img->width || (unsigned int)y >= img->height)
+        return true;
+    return vdraw(img, x, y, 1, NULL, color, SIMAGE_BLEND_NONE);
+}
+
+bool simage_virtual_pset(simage_virtual *img, int x, int y, sg_color color) {
+    return vpset(img, x, y, sg_color_to_int(color));
+}
+
+sg_color simage_virtual_pget(simage_virtual *img, int x, int y) {
+    int32_t color = 0;
+    if (x >= 0 && y >= 0 && (unsigned int)x < img->width && (unsigned int)y < img->height)
+        vspan(img, x, y, 1, &color, false);
+    return int_to_sg_color(color);
+}
+
+bool simage_virtual_blend(simage_virtual *dst, simage_buffer *src, int x, int y, simage_blend_mode mode) {
+    int x0 = _MAX(x, 0), y0 = _MAX(y, 0);
+    int x1 = (int)_MIN((int64_t)x + src->width, (int64_t)dst->width);
+    int y1 = (int)_MIN((int64_t)y + src->height, (int64_t)dst->height);
+    bool ok = true;
+    for (int py = y0; py < y1 && x0 < x1; py++)
+        if (!vdraw(dst, x0, py, x1 - x0, src->buffer + (size_t)(py - y) * src->width + (x0 - x), 0, mode))
+            ok = false;
+    return ok;
+}
+
+bool simage_virtual_paste(simage_virtual *dst, simage_buffer *src, int x, int y) {
+    return simage_virtual_blend(dst, src, x, y, SIMAGE_BLEND_NONE);
+}
+
+bool simage_virtual_clipped(simage_virtual *src, int rx, int ry, int rw, int rh, simage_buffer *dst) {
+    int ox = (int)_CLAMP((int64_t)rx, 0, (int64_t)src->width);
+    int oy = (int)_CLAMP((int64_t)ry, 0, (int64_t)src->height);
+    if ((unsigned int)ox >= src->width || (unsigned int)oy >= src->height)
+        return false;
+    int iw = (int)_MIN((int64_t)ox + rw, (int64_t)src->width) - ox;
+    int ih = (int)_MIN((int64_t)oy + rh, (int64_t)src->height) - oy;
+    if (iw <= 0 || ih <= 0)
+        return false;
+    if (!simage_empty(iw, ih, sg_black, dst))
+        return false;
+    for (int py = 0; py < ih; py++)
+        if (!vspan(src, ox, oy + py, iw, dst->buffer + (size_t)py * iw, false)) {
+            simage_destroy_buffer(dst);
+            return false;
+        }
+    return true;
+}
+
+bool simage_virtual_resized(simage_virtual *src, int nw, int nh, simage_buffer *dst) {
+    if (!simage_empty(nw, nh, sg_black, dst))
+        return false;
+    int32_t *row = malloc(src->width * sizeof(int32_t));
+    if (!row) {
+        simage_destroy_buffer(dst);
+        return false;
+    }
+    int last = -1;
+    for (int i = 0; i < nh; i++) {
+        int sy = (int)(((uint64_t)i * src->height + src->height / 2) / nh);
+        if (sy != last && !vspan(src, 0, sy, src->width, row, false)) {
+            free(row);
+            simage_destroy_buffer(dst);
+            return false;
+        }
+        last = sy;
+        int32_t *t = dst->buffer + (size_t)i * nw;
+        for (int j = 0; j < nw; j++)
+            t[j] = row[((uint64_t)j * src->width + src->width / 2) / nw];
+    }
+    free(row);
+    return true;
+}
+
+// Inclusive spans clipped to the image, matching hline and vline
+static bool vhline(simage_virtual *img, int y, int x0, int x1, uint32_t color) {
+    if (x1 < x0) {
+        int t = x0;
+        x0 = x1;
+        x1 = t;
+    }
+    if (y < 0 || (unsigned int)y >= img->height)
+        return true;
+    int64_t a = _MAX(x0, 0), b = _MIN((int64_t)x1 + 1, (int64_t)img->width);
+    return a >= b || vdraw(img, (unsigned int)a, y, (unsigned int)(b - a), NULL, color, SIMAGE_BLEND_NONE);
+}
+
+static bool vvline(simage_virtual *img, int x, int y0, int y1, uint32_t color) {
+    if (y1 < y0) {
+        int t = y0;
+        y0 = y1;
+        y1 = t;
+    }
+    if (x < 0 || (unsigned int)x >= img->width || y1 < 0 || (y0 >= 0 && (unsigned int)y0 >= img->height))
+        return true;
+    bool ok = true;
+    for (int64_t y = _MAX(y0, 0); y <= _MIN((int64_t)y1, (int64_t)img->height - 1); y++)
+        if (!vdraw(img, x, (unsigned int)y, 1, NULL, color, SIMAGE_BLEND_NONE))
+            ok = false;
+    return ok;
+}
+
+bool simage_virtual_draw_line(simage_virtual *img, int x0, int y0, int x1, int y1, sg_color color) {
+    uint32_t c = sg_color_to_int(color);
+    if (x0 == x1)
+        return vvline(img, x0, y0, y1, c);
+    if (y0 == y1)
+        return vhline(img, y0, x0, x1, c);
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = (dx > dy ? dx : -dy) / 2;
+    bool ok = true;
+    for (;;) {
+        if (!vpset(img, x0, y0, c))
+            ok = false;
+        if (x0 == x1 && y0 == y1)
+            break;
+        int e2 = err;
+        if (e2 > -dx) { err -= dy; x0 += sx; }
+        if (e2 <  dy) { err += dx; y0 += sy; }
+    }
+    return ok;
+}
+
+bool simage_virtual_draw_rectangle(simage_virtual *img, int x, int y, int w, int h, sg_color color, int fill) {
+    uint32_t c = sg_color_to_int(color);
+    if (x < 0) {
+        w += x;
+        x  = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y  = 0;
+    }
+
+    w += x;
+    h += y;
+    if (w < 0 || h < 0 || (unsigned int)x > img->width || (unsigned int)y > img->height)
+        return true;
+
+    if ((unsigned int)w > img->width)
+        w = img->width;
+    if ((unsigned int)h > img->height)
+        h = img->height;
+
+    bool ok = true;
+    if (fill) {
+        int x1 = (int)_MIN((int64_t)w + 1, (int64_t)img->width);
+        for (int py = y; py < h && x < x1; py++)
+            if (!vdraw(img, x, py, x1 - x, NULL, c, SIMAGE_BLEND_NONE))
+                ok = false;
+    } else {
+        ok &= vhline(img, y, x, w, c);
+        ok &= vhline(img, h, x, w, c);
+        ok &= vvline(img, x, y, h, c);
+        ok &= vvline(img, w, y, h, c);
+    }
+    return ok;
+}
+
+/* Half-open rectangle the drawing internals are limited to. The public functions pass the whole
+   image, canvases pass the tile being rasterized. Shapes are always set up against the whole
+   image so a tile draws exactly the pixels the immediate call would */
+typedef struct draw_clip {
+    int x0, y0, x1, y1;
+} draw_clip_t;
+
+static inline draw_clip_t image_clip(simage_buffer *img) {
+    if (!img->buffer)
+        return (draw_clip_t){0, 0, 0, 0};
+    return (draw_clip_t){0, 0, (int)img->width, (int)img->height};
+}
+
+static inline int clamp_coord(float v, int lo, int hi) {
+    return (int)_CLAMP(v, (float)lo, (float)hi);
+}
+
+static inline void clip_pset(simage_buffer *img, const draw_clip_t *clip, int x, int y, uint32_t color) {
+    if (x >= clip->x0 && y >= clip->y0 && x < clip->x1 && y < clip->y1)
+        simage_row_ptr(img, y)[x] = color;
+}
+
+static inline void clip_fill(simage_buffer *img, const draw_clip_t *clip, int x, int y, int n, uint32_t color) {
+    if (y < clip->y0 || y >= clip->y1)
+        return;
+    int x0 = _MAX(x, clip->x0), x1 = (int)_MIN((int64_t)x + n, (int64_t)clip->x1);
+    if (x0 < x1)
+        fill_row(simage_row_ptr(img, y) + x0, x1 - x0, color, false);
+}
+
+static inline void vline(simage_buffer *img, const draw_clip_t *clip, int x, int y0, int y1, uint32_t color) {
+    if (y1 < y0) {
+        y0 += y1;
+        y1  = y0 - y1;
+        y0 -= y1;
+    }
+
+    if (x < clip->x0 || x >= clip->x1 || y0 >= clip->y1 || y1 < clip->y0)
+        return;
+
+    if (y0 < clip->y0)
+        y0 = clip->y0;
+    if (y1 >= clip->y1)
+        y1 = clip->y1 - 1;
+
+    uint32_t *p = simage_row_ptr(img, y0) + x;
+    for(int y = y0; y <= y1; y++, p += img->width)
+        *p = color;
+}
+
+static inline void hline(simage_buffer *img, const draw_clip_t *clip, int y, int x0, int x1, uint32_t color) {
+    if (x1 < x0) {
+        x0 += x1;
+        x1  = x0 - x1;
+        x0 -= x1;
+    }
+
+    clip_fill(img, clip, x0, y, x1 - x0 + 1, color);
+}
+
+static void draw_line(simage_buffer *img, const draw_clip_t *clip, int x0, int y0, int x1, int y1, uint32_t color) {
+    if (x0 == x1)
+        vline(img, clip, x0, y0, y1, color);
+    else if (y0 == y1)
+        hline(img, clip, y0, x0, x1, color);
+    else {
+        int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+        int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+        int err = (dx > dy ? dx : -dy) / 2;
+
+        while (clip_pset(img, clip, x0, y0, color), x0 != x1 || y0 != y1) {
+            int e2 = err;
+            if (e2 > -dx) { err -= dy; x0 += sx; }
+            if (e2 <  dy) { err += dx; y0 += sy; }
+        }
+    }
+}
+
+void simage_draw_line(simage_buffer *img, int x0, int y0, int x1, int y1, sg_color color) {
+    draw_clip_t clip = image_clip(img);
+    draw_line(img, &clip, x0, y0, x1, y1, sg_color_to_int(color));
+}
+
+static void draw_circle(simage_buffer *img, const draw_clip_t *clip, int xc, int yc, int r, uint32_t color, bool fill) {
+    int x = -r, y = 0, err = 2 - 2 * r; /* II. Quadrant */
+    do {
+        clip_pset(img, clip, xc - x, yc + y, color);    /*   I. Quadrant */
+        clip_pset(img, clip, xc - y, yc - x, color);    /*  II. Quadrant */
+        clip_pset(img, clip, xc + x, yc - y, color);    /* III. Quadrant */
+        clip_pset(img, clip, xc + y, yc + x, color);    /*  IV. Quadrant */
+
+        if (fill) {
+            hline(img, clip, yc - y, xc - x, xc + x, color);
+            hline(img, clip, yc + y, xc - x, xc + x, color);
+        }
+
+        r = err;
+        if (r <= y)
+            err += ++y * 2 + 1; /* e_xy+e_y < 0 */
+        if (r > x || err > y)
+            err += ++x * 2 + 1; /* e_xy+e_x > 0 or no 2nd y-step */
+    } while (x < 0);
+}
+
+void simage_draw_circle(simage_buffer *img, int xc, int yc, int r, sg_color color, int fill) {
+    draw_clip_t clip = image_clip(img);
+    draw_circle(img, &clip, xc, yc, r, sg_color_to_int(color), fill);
+}
+
+static void draw_rectangle(simage_buffer *img, const draw_clip_t *clip, int x, int y, int w, int h, uint32_t color, bool fill) {
     if (x < 0) {
         w += x;
         x  = 0;
     }
-    if (y < 0) {
-        h += y;
-        y  = 0;
+    if (y < 0) {
+        h += y;
+        y  = 0;
+    }
+
+    w += x;
+    h += y;
+    if (w < 0 || h < 0 || x > img->width || y > img->height)
+        return;
+
+    if (w > img->width)
+        w = img->width;
+    if (h > img->height)
+        h = img->height;
+
+    if (fill) {
+        int x0 = _MAX(x, clip->x0), y0 = _MAX(y, clip->y0);
+        int x1 = _MIN(w + 1, clip->x1), y1 = _MIN(h, clip->y1);
+        if (x0 < x1 && y0 < y1)
+            fill_rect(img, x0, y0, x1 - x0, y1 - y0, color);
+    } else {
+        hline(img, clip, y, x, w, color);
+        hline(img, clip, h, x, w, color);
+        vline(img, clip, x, y, h, color);
+        vline(img, clip, w, y, h, color);
+    }
+}
+
+void simage_draw_rectangle(simage_buffer *img, int x, int y, int w, int h, sg_color color, int fill) {
+    draw_clip_t clip = image_clip(img);
+    draw_rectangle(img, &clip, x, y, w, h, sg_color_to_int(color), fill);
+}
+
+/* Half-space triangle rasterizer. Vertices are 28.4 fixed point with integer coordinates at pixel
+   centers. Edge functions are evaluated exactly at the centers and the top-left rule decides the
+   pixels lying on an edge, so triangles sharing an edge never both cover a pixel. Bounding boxes
+   fitting an 8x8 block take the SIMD coverage masks of the block, larger ones step the edges from
+   row to row, covered pixels are handed to fn as horizontal spans. Large triangles deliberately
+   skip block accept/reject: a row costs O(1) whatever its width, where blocks cost one mask per
+   8x8 cell crossed and measured 1.3-2x slower from 16 px up */
+#define _RASTER_BITS 4
+#define _RASTER_BLOCK 8
+// Vertices beyond the range of int pixel coordinates are clipped to it first
+#define _RASTER_GUARD ((int64_t)1 << (31 + _RASTER_BITS))
+
+typedef void(*span_fn)(void *userdata, int y, int x, int n);
+
+// E(x, y) = a * (x - x0) + b * (y - y0) + c from the first pixel of the box, >= 0 inside (the fill rule bias is in c)
+typedef struct raster_edge {
+    int64_t a, b, c;
+} raster_edge_t;
+
+typedef struct raster {
+    raster_edge_t edges[3];
+    // Set when the values of an edge crossing a block may not fit in 32 bits
+    bool wide;
+} raster_t;
+
+/* a * b - c * d, exact while it fits in 62 bits and saturated beyond. The products may wrap
+   around when the difference fits, the estimate tells which case it is */
+static inline int64_t raster_cross(int64_t a, int64_t b, int64_t c, int64_t d) {
+    const int64_t limit = (int64_t)1 << 62;
+    double estimate = (double)a * (double)b - (double)c * (double)d;
+    if (estimate >= (double)limit)
+        return limit;
+    if (estimate <= -(double)limit)
+        return -limit;
+    return (int64_t)((uint64_t)a * (uint64_t)b - (uint64_t)c * (uint64_t)d);
+}
+
+/* Edges of a triangle with vertices within _RASTER_GUARD relative to pixel (x0, y0), false when
+   it covers nothing. An edge saturating there stays on one side across any image, covering all
+   of it drops it to a constant and covering none rejects the triangle */
+static bool raster_setup(raster_t *r, const int64_t v[6], int x0, int y0) {
+    const int64_t limit = (int64_t)1 << 62;
+    int64_t area = raster_cross(v[2] - v[0], v[5] - v[1], v[3] - v[1], v[4] - v[0]);
+    if (!area)
+        return false;
+    // Clockwise triangles walk their edges backwards so the inside of every edge is positive
+    int64_t sign = area > 0 ? 1 : -1, extent = 0;
+    for (int k = 0; k < 3; k++) {
+        const int64_t *p = v + k * 2, *q = v + (k + 1) % 3 * 2;
+        int64_t dx = (q[0] - p[0]) * sign, dy = (q[1] - p[1]) * sign;
+        bool top_left = dy < 0 || (dy == 0 && dx > 0);
+        raster_edge_t *e = &r->edges[k];
+        e->a = -dy * (1 << _RASTER_BITS);
+        e->b = dx * (1 << _RASTER_BITS);
+        e->c = raster_cross(dy, p[0] - ((int64_t)x0 << _RASTER_BITS), dx, p[1] - ((int64_t)y0 << _RASTER_BITS)) - !top_left;
+        if (e->c < -limit)
+            return false;
+        if (e->c >= limit - 1) {
+            e->a = e->b = 0;
+            e->c = INT32_MAX;
+            continue;
+        }
+        extent = _MAX(extent, (dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy));
+    }
+    // An edge crossing a block stays within 2 * _RASTER_BLOCK pixel steps of zero across it
+    r->wide = extent * (2 * _RASTER_BLOCK << _RASTER_BITS) >= INT32_MAX;
+    return true;
+}
+
+/* Coverage bits of the rows of a block, bit i of masks[y] is pixel x + i of row y. values holds
+   each edge at the block's first pixel, edges not in `partial` cover the whole block. Pixels are
+   outside when any of their edge values is negative, so the sign bits of the edges are ORed */
+static inline void raster_block(const raster_t *r, const int64_t *values, unsigned partial, int rows, uint8_t *masks) {
+    if (r->wide) {
+        for (int y = 0; y < rows; y++) {
+            unsigned mask = 0xFF;
+            for (int k = 0; k < 3; k++)
+                for (int x = 0; x < _RASTER_BLOCK && (partial >> k & 1); x++)
+                    if (values[k] + r->edges[k].a * x + r->edges[k].b * y < 0)
+                        mask &= ~(1u << x);
+            masks[y] = (uint8_t)mask;
+        }
+        return;
+    }
+    // Edges covering the whole block are zeroed so they never set a sign bit
+    int32_t c[3], a[3], b[3];
+    for (int k = 0; k < 3; k++) {
+        int32_t used = -(int32_t)(partial >> k & 1);
+        c[k] = (int32_t)values[k] & used;
+        a[k] = (int32_t)r->edges[k].a & used;
+        b[k] = (int32_t)r->edges[k].b & used;
+    }
+    // Spelled out per edge so the vectors stay in registers
+#if defined(SIMAGE_AVX2)
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i v0 = _mm256_add_epi32(_mm256_set1_epi32(c[0]), _mm256_mullo_epi32(_mm256_set1_epi32(a[0]), lanes));
+    __m256i v1 = _mm256_add_epi32(_mm256_set1_epi32(c[1]), _mm256_mullo_epi32(_mm256_set1_epi32(a[1]), lanes));
+    __m256i v2 = _mm256_add_epi32(_mm256_set1_epi32(c[2]), _mm256_mullo_epi32(_mm256_set1_epi32(a[2]), lanes));
+    __m256i d0 = _mm256_set1_epi32(b[0]), d1 = _mm256_set1_epi32(b[1]), d2 = _mm256_set1_epi32(b[2]);
+    for (int y = 0; y < rows; y++) {
+        masks[y] = (uint8_t)~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_or_si256(v0, v1), v2)));
+        v0 = _mm256_add_epi32(v0, d0);
+        v1 = _mm256_add_epi32(v1, d1);
+        v2 = _mm256_add_epi32(v2, d2);
+    }
+#elif defined(SIMAGE_SSE2)
+    __m128i l0 = _mm_setr_epi32(c[0], c[0] + a[0], c[0] + a[0] * 2, c[0] + a[0] * 3);
+    __m128i l1 = _mm_setr_epi32(c[1], c[1] + a[1], c[1] + a[1] * 2, c[1] + a[1] * 3);
+    __m128i l2 = _mm_setr_epi32(c[2], c[2] + a[2], c[2] + a[2] * 2, c[2] + a[2] * 3);
+    __m128i h0 = _mm_add_epi32(l0, _mm_set1_epi32(a[0] * 4));
+    __m128i h1 = _mm_add_epi32(l1, _mm_set1_epi32(a[1] * 4));
+    __m128i h2 = _mm_add_epi32(l2, _mm_set1_epi32(a[2] * 4));
+    __m128i d0 = _mm_set1_epi32(b[0]), d1 = _mm_set1_epi32(b[1]), d2 = _mm_set1_epi32(b[2]);
+    for (int y = 0; y < rows; y++) {
+        __m128i l = _mm_or_si128(_mm_or_si128(l0, l1), l2), h = _mm_or_si128(_mm_or_si128(h0, h1), h2);
+        masks[y] = (uint8_t)~(_mm_movemask_ps(_mm_castsi128_ps(l)) | _mm_movemask_ps(_mm_castsi128_ps(h)) << 4);
+        l0 = _mm_add_epi32(l0, d0);
+        l1 = _mm_add_epi32(l1, d1);
+        l2 = _mm_add_epi32(l2, d2);
+        h0 = _mm_add_epi32(h0, d0);
+        h1 = _mm_add_epi32(h1, d1);
+        h2 = _mm_add_epi32(h2, d2);
+    }
+#elif defined(SIMAGE_NEON)
+    static const int32_t lanes[4] = {0, 1, 2, 3};
+    static const uint32_t bits[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    int32x4_t l0 = vmlaq_n_s32(vdupq_n_s32(c[0]), vld1q_s32(lanes), a[0]);
+    int32x4_t l1 = vmlaq_n_s32(vdupq_n_s32(c[1]), vld1q_s32(lanes), a[1]);
+    int32x4_t l2 = vmlaq_n_s32(vdupq_n_s32(c[2]), vld1q_s32(lanes), a[2]);
+    int32x4_t h0 = vaddq_s32(l0, vdupq_n_s32(a[0] * 4));
+    int32x4_t h1 = vaddq_s32(l1, vdupq_n_s32(a[1] * 4));
+    int32x4_t h2 = vaddq_s32(l2, vdupq_n_s32(a[2] * 4));
+    int32x4_t d0 = vdupq_n_s32(b[0]), d1 = vdupq_n_s32(b[1]), d2 = vdupq_n_s32(b[2]);
+    for (int y = 0; y < rows; y++) {
+        uint32x4_t l = vreinterpretq_u32_s32(vorrq_s32(vorrq_s32(l0, l1), l2));
+        uint32x4_t h = vreinterpretq_u32_s32(vorrq_s32(vorrq_s32(h0, h1), h2));
+        uint32x4_t sign = vaddq_u32(vmulq_u32(vshrq_n_u32(l, 31), vld1q_u32(bits)), vmulq_u32(vshrq_n_u32(h, 31), vld1q_u32(bits + 4)));
+        uint32x2_t sum = vpadd_u32(vget_low_u32(sign), vget_high_u32(sign));
+        masks[y] = (uint8_t)~(vget_lane_u32(sum, 0) + vget_lane_u32(sum, 1));
+        l0 = vaddq_s32(l0, d0);
+        l1 = vaddq_s32(l1, d1);
+        l2 = vaddq_s32(l2, d2);
+        h0 = vaddq_s32(h0, d0);
+        h1 = vaddq_s32(h1, d1);
+        h2 = vaddq_s32(h2, d2);
+    }
+#else
+    for (int y = 0; y < rows; y++) {
+        unsigned mask = 0xFF;
+        for (int x = 0; x < _RASTER_BLOCK; x++)
+            if ((c[0] + a[0] * x + b[0] * y) < 0 || (c[1] + a[1] * x + b[1] * y) < 0 || (c[2] + a[2] * x + b[2] * y) < 0)
+                mask &= ~(1u << x);
+        masks[y] = (uint8_t)mask;
+    }
+#endif
+}
+
+// First covered pixel of a row mask in the low nibble, one past its last in the high nibble
+static const uint8_t raster_run_bits[256] = {
+    0x00, 0x10, 0x21, 0x20, 0x32, 0x30, 0x31, 0x30, 0x43, 0x40, 0x41, 0x40, 0x42, 0x40, 0x41, 0x40,
+    0x54, 0x50, 0x51, 0x50, 0x52, 0x50, 0x51, 0x50, 0x53, 0x50, 0x51, 0x50, 0x52, 0x50, 0x51, 0x50,
+    0x65, 0x60, 0x61, 0x60, 0x62, 0x60, 0x61, 0x60, 0x63, 0x60, 0x61, 0x60, 0x62, 0x60, 0x61, 0x60,
+    0x64, 0x60, 0x61, 0x60, 0x62, 0x60, 0x61, 0x60, 0x63, 0x60, 0x61, 0x60, 0x62, 0x60, 0x61, 0x60,
+    0x76, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70, 0x73, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70,
+    0x74, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70, 0x73, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70,
+    0x75, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70, 0x73, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70,
+    0x74, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70, 0x73, 0x70, 0x71, 0x70, 0x72, 0x70, 0x71, 0x70,
+    0x87, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x84, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x85, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x84, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x86, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x84, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x85, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80,
+    0x84, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80, 0x83, 0x80, 0x81, 0x80, 0x82, 0x80, 0x81, 0x80
+};
+
+/* Row by row walk of the box [x0, x1) x [y0, y1). An edge with value n at the first pixel of a row
+   bounds its run at floor(n / |a|), the quotient and remainder are stepped exactly between rows. Flat
+   edges are skipped, the vertex bounds already stop at them with the top-left rule, and so are
+   edges covering everything */
+static void raster_rows(const raster_t *r, int x0, int y0, int x1, int y1, span_fn fn, void *userdata) {
+    // Two edges bounding where rows start then two bounding where they end, unused ones never cut
+    int64_t q[4], rem[4], dq[4], drem[4], d[4];
+    int slot[2] = {0, 2};
+    for (int k = 0; k < 4; k++) {
+        q[k] = INT32_MAX;
+        rem[k] = dq[k] = drem[k] = 0;
+        d[k] = 1;
+    }
+    for (int k = 0; k < 3; k++) {
+        const raster_edge_t *e = &r->edges[k];
+        if (!e->a)
+            continue;
+        int i = slot[e->a < 0]++;
+        d[i] = e->a < 0 ? -e->a : e->a;
+        q[i] = floor_div(e->c, d[i]);
+        rem[i] = e->c - q[i] * d[i];
+        dq[i] = floor_div(e->b, d[i]);
+        drem[i] = e->b - dq[i] * d[i];
+    }
+    int64_t w = x1 - x0;
+    for (int y = y0; y < y1; y++) {
+        int64_t start = _MAX(_MAX(-q[0], -q[1]), 0), end = _MIN(_MIN(q[2], q[3]) + 1, w);
+        if (start < end)
+            fn(userdata, y, x0 + (int)start, (int)(end - start));
+        for (int k = 0; k < 4; k++) {
+            int64_t carry;
+            rem[k] += drem[k];
+            carry = rem[k] >= d[k];
+            q[k] += dq[k] + carry;
+            rem[k] -= d[k] & -carry;
+        }
+    }
+}
+
+// Vertices within the guard band
+static void raster_spans(const draw_clip_t *clip, const int64_t v[6], span_fn fn, void *userdata) {
+    // Pixels whose centers lie in the vertex bounds, a center on the right or bottom bound is never covered
+    int64_t min_x = _MIN(_MIN(v[0], v[2]), v[4]), max_x = _MAX(_MAX(v[0], v[2]), v[4]);
+    int64_t min_y = _MIN(_MIN(v[1], v[3]), v[5]), max_y = _MAX(_MAX(v[1], v[3]), v[5]);
+    int x0 = (int)_MAX((min_x + (1 << _RASTER_BITS) - 1) >> _RASTER_BITS, (int64_t)clip->x0);
+    int x1 = (int)_MIN((max_x + (1 << _RASTER_BITS) - 1) >> _RASTER_BITS, (int64_t)clip->x1);
+    int y0 = (int)_MAX((min_y + (1 << _RASTER_BITS) - 1) >> _RASTER_BITS, (int64_t)clip->y0);
+    int y1 = (int)_MIN((max_y + (1 << _RASTER_BITS) - 1) >> _RASTER_BITS, (int64_t)clip->y1);
+    raster_t r;
+    if (x0 >= x1 || y0 >= y1 || !raster_setup(&r, v, x0, y0))
+        return;
+    if (x1 - x0 > _RASTER_BLOCK || y1 - y0 > _RASTER_BLOCK) {
+        raster_rows(&r, x0, y0, x1, y1, fn, userdata);
+        return;
+    }
+    // Fits a single block, every row is one run of its mask. Edges not crossing it stay out of the masks
+    int64_t values[3];
+    uint8_t masks[_RASTER_BLOCK];
+    unsigned partial = 0;
+    for (int k = 0; k < 3; k++) {
+        const raster_edge_t *e = &r.edges[k];
+        int64_t lo = _MIN(e->a, 0) * (x1 - x0 - 1) + _MIN(e->b, 0) * (y1 - y0 - 1);
+        int64_t hi = _MAX(e->a, 0) * (x1 - x0 - 1) + _MAX(e->b, 0) * (y1 - y0 - 1);
+        if (e->c + hi < 0)
+            return;
+        partial |= (unsigned)(e->c + lo < 0) << k;
+        values[k] = e->c;
+    }
+    raster_block(&r, values, partial, y1 - y0, masks);
+    for (int i = 0; i < y1 - y0; i++) {
+        int bits = raster_run_bits[masks[i] & (0xFFu >> (_RASTER_BLOCK - (x1 - x0)))];
+        if (bits)
+            fn(userdata, y0 + i, x0 + (bits & 15), (bits >> 4) - (bits & 15));
+    }
+}
+
+/* Triangles reaching past the guard band, which only floating point vertices can, are clipped to
+   it and split into a fan. The clipped corners are rounded, fan triangles share their edges
+   exactly and a sliver flipped by the rounding is dropped rather than drawn twice */
+static void raster_triangle(const draw_clip_t *clip, const int64_t v[6], span_fn fn, void *userdata) {
+    bool inside = true;
+    for (int i = 0; i < 6; i++)
+        inside &= v[i] >= -_RASTER_GUARD && v[i] <= _RASTER_GUARD;
+    if (inside) {
+        raster_spans(clip, v, fn, userdata);
+        return;
+    }
+    double p[7][2], o[7][2];
+    int n = 3;
+    for (int i = 0; i < 3; i++) {
+        p[i][0] = (double)v[i * 2];
+        p[i][1] = (double)v[i * 2 + 1];
+    }
+    double area = (p[1][0] - p[0][0]) * (p[2][1] - p[0][1]) - (p[1][1] - p[0][1]) * (p[2][0] - p[0][0]);
+    // Left, top, right and bottom side of the band
+    for (int side = 0; side < 4 && n; side++) {
+        int axis = side & 1, m = 0;
+        double bound = (double)(side < 2 ? -_RASTER_GUARD : _RASTER_GUARD), sign = side < 2 ? 1. : -1.;
+        for (int i = 0; i < n; i++) {
+            const double *a = p[i], *b = p[(i + 1) % n];
+            double da = (a[axis] - bound) * sign, db = (b[axis] - bound) * sign;
+            if (da >= 0.) {
+                o[m][0] = a[0];
+                o[m++][1] = a[1];
+            }
+            if ((da < 0.) != (db < 0.)) {
+                // From the end inside, the far one only sets the direction
+                const double *in = da < 0. ? b : a, *out = da < 0. ? a : b;
+                double t = (in[axis] - bound) / (in[axis] - out[axis]);
+                o[m][0] = in[0] + (out[0] - in[0]) * t;
+                o[m][1] = in[1] + (out[1] - in[1]) * t;
+                o[m++][axis] = bound;
+            }
+        }
+        memcpy(p, o, sizeof(double) * 2 * m);
+        n = m;
+    }
+    for (int i = 2; i < n; i++) {
+        int64_t t[6] = {
+            (int64_t)floor(p[0][0] + .5), (int64_t)floor(p[0][1] + .5),
+            (int64_t)floor(p[i - 1][0] + .5), (int64_t)floor(p[i - 1][1] + .5),
+            (int64_t)floor(p[i][0] + .5), (int64_t)floor(p[i][1] + .5)
+        };
+        if ((raster_cross(t[2] - t[0], t[5] - t[1], t[3] - t[1], t[4] - t[0]) > 0) == (area > 0.))
+            raster_spans(clip, t, fn, userdata);
+    }
+}
+
+typedef struct fill_span {
+    simage_buffer *img;
+    uint32_t color;
+} fill_span_t;
+
+static void fill_span(void *userdata, int y, int x, int n) {
+    fill_span_t *s = (fill_span_t*)userdata;
+    fill_row(simage_row_ptr(s->img, y) + x, n, s->color, false);
+}
+
+static void draw_triangle(simage_buffer *img, const draw_clip_t *clip, int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, bool fill) {
+    if (y0 ==  y1 && y0 ==  y2)
+        return;
+    if (fill) {
+        int64_t v[6] = {x0, y0, x1, y1, x2, y2};
+        for (int i = 0; i < 6; i++)
+            v[i] *= 1 << _RASTER_BITS;
+        fill_span_t span = {img, color};
+        raster_triangle(clip, v, fill_span, &span);
+    } else {
+        draw_line(img, clip, x0, y0, x1, y1, color);
+        draw_line(img, clip, x1, y1, x2, y2, color);
+        draw_line(img, clip, x2, y2, x0, y0, color);
+    }
+}
+
+void simage_draw_triangle(simage_buffer *img, int x0, int y0, int x1, int y1, int x2, int y2, sg_color color, int fill) {
+    draw_clip_t clip = image_clip(img);
+    draw_triangle(img, &clip, x0, y0, x1, y1, x2, y2, sg_color_to_int(color), fill);
+}
+
+/* Perspective correct triangle fills. Depth and every attribute divided by w are planes over the
+   screen, stored relative to the pixel of the first vertex. Spans evaluate the planes per pixel
+   and divide by the interpolated 1 / w, four pixels at a time where SIMD is available */
+enum {
+    ATTR_Z,
+    ATTR_Q,
+    ATTR_U,
+    ATTR_V,
+    ATTR_R,
+    ATTR_G,
+    ATTR_B,
+    ATTR_A,
+    ATTR_COUNT
+};
+
+typedef struct shade {
+    simage_buffer *img, *texture;
+    simage_depth *depth;
+    simage_filter filter;
+    simage_edge_mode edge;
+    // Pixel the planes are relative to
+    int x, y;
+    float base[ATTR_COUNT], dx[ATTR_COUNT], dy[ATTR_COUNT];
+} shade_t;
+
+static inline uint16_t depth16(float z) {
+    return (uint16_t)(_CLAMP(z, 0.f, 1.f) * 65535.f + .5f);
+}
+
+bool simage_depth_empty(unsigned int w, unsigned int h, int bits, simage_depth *dst) {
+    if (!w || !h || (bits != 16 && bits != 32))
+        return false;
+    dst->width = w;
+    dst->height = h;
+    dst->bits = bits;
+    if (!(dst->buffer = malloc((size_t)w * h * (bits / 8))))
+        return false;
+    simage_depth_clear(dst, 1.f);
+    return true;
+}
+
+void simage_depth_clear(simage_depth *depth, float value) {
+    if (!depth->buffer)
+        return;
+    size_t n = (size_t)depth->width * depth->height, bytes = n * (depth->bits / 8);
+    uint32_t word;
+    if (depth->bits == 16) {
+        uint16_t z = depth16(value);
+        word = (uint32_t)z << 16 | z;
+        if (n & 1)
+            ((uint16_t*)depth->buffer)[n - 1] = z;
+    } else
+        memcpy(&word, &value, sizeof(float));
+    fill_row((uint32_t*)depth->buffer, bytes / 4, word, bytes > SIMAGE_STREAM_THRESHOLD);
+#if defined(SIMAGE_SSE2)
+    if (bytes > SIMAGE_STREAM_THRESHOLD)
+        _mm_sfence();
+#endif
+}
+
+void simage_depth_destroy(simage_depth *depth) {
+    free(depth->buffer);
+    memset(depth, 0, sizeof(simage_depth));
+}
+
+/* Snaps the vertices to 28.4 for the rasterizer and sets up the attribute planes from the snapped
+   positions. The planes are relative to the pixel of the first vertex moved into the image, so far
+   away vertices keep them precise and every band of rows sees the same planes */
+static bool shade_setup(shade_t *s, const simage_vertex *vertices, int64_t v[6]) {
+    // Bounded only so the conversion is defined, the rasterizer clips larger triangles itself
+    const float range = (float)((int64_t)1 << 62);
+    float a[3][ATTR_COUNT];
+    for (int i = 0; i < 3; i++) {
+        const simage_vertex *p = &vertices[i];
+        if (!(p->w > 0.f))
+            return false;
+        float q = 1.f / p->w;
+        v[i * 2] = (int64_t)_CLAMP(floorf(p->x * (1 << _RASTER_BITS) + .5f), -range, range);
+        v[i * 2 + 1] = (int64_t)_CLAMP(floorf(p->y * (1 << _RASTER_BITS) + .5f), -range, range);
+        a[i][ATTR_Z] = p->z;
+        a[i][ATTR_Q] = q;
+        a[i][ATTR_U] = p->u * q;
+        a[i][ATTR_V] = p->v * q;
+        a[i][ATTR_R] = p->color.r * 255.f * q;
+        a[i][ATTR_G] = p->color.g * 255.f * q;
+        a[i][ATTR_B] = p->color.b * 255.f * q;
+        a[i][ATTR_A] = p->color.a * 255.f * q;
+    }
+    double x1 = ((double)v[2] - (double)v[0]) / (1 << _RASTER_BITS), y1 = ((double)v[3] - (double)v[1]) / (1 << _RASTER_BITS);
+    double x2 = ((double)v[4] - (double)v[0]) / (1 << _RASTER_BITS), y2 = ((double)v[5] - (double)v[1]) / (1 << _RASTER_BITS);
+    double det = x1 * y2 - x2 * y1;
+    if (det == 0.)
+        return false;
+    s->x = (int)_CLAMP(v[0] >> _RASTER_BITS, (int64_t)0, (int64_t)s->img->width);
+    s->y = (int)_CLAMP(v[1] >> _RASTER_BITS, (int64_t)0, (int64_t)s->img->height);
+    double ox = s->x - (double)v[0] / (1 << _RASTER_BITS), oy = s->y - (double)v[1] / (1 << _RASTER_BITS);
+    for (int k = 0; k < ATTR_COUNT; k++) {
+        double d1 = (double)a[1][k] - a[0][k], d2 = (double)a[2][k] - a[0][k];
+        double dx = (d1 * y2 - d2 * y1) / det, dy = (d2 * x1 - d1 * x2) / det;
+        s->base[k] = (float)(a[0][k] + dx * ox + dy * oy);
+        s->dx[k] = (float)dx;
+        s->dy[k] = (float)dy;
+    }
+    return true;
+}
+
+// Texel at a normalized position, transparent outside the texture with SIMAGE_EDGE_NONE
+static inline uint32_t texture_sample(const shade_t *s, float u, float v) {
+    simage_buffer *tex = s->texture;
+    int w = tex->width, h = tex->height;
+    // Bounded so the conversions below are defined, wrapping only depends on the position modulo the size
+    float fu = _CLAMP(u * w, -1e9f, 1e9f), fv = _CLAMP(v * h, -1e9f, 1e9f);
+    int64_t x = (int64_t)floorf(fu), y = (int64_t)floorf(fv);
+    if (s->edge == SIMAGE_EDGE_NONE && (x < 0 || x >= w || y < 0 || y >= h))
+        return 0;
+    simage_edge_mode edge = s->edge == SIMAGE_EDGE_WRAP ? SIMAGE_EDGE_WRAP : SIMAGE_EDGE_CLAMP;
+    if (s->filter == SIMAGE_FILTER_NEAREST)
+        return simage_row_ptr(tex, edge_index(y, h, edge))[edge_index(x, w, edge)];
+    // Texel centers are at half pixels, 7 bits of fraction for bilerp
+    int64_t px = (int64_t)floorf(fu * 128.f) - 64, py = (int64_t)floorf(fv * 128.f) - 64;
+    int fx = (int)(px & 127), fy = (int)(py & 127);
+    x = px >> 7;
+    y = py >> 7;
+    if (x >= 0 && x + 1 < w && y >= 0 && y + 1 < h) {
+        const uint32_t *p = simage_row_ptr(tex, (int)y) + x;
+        uint64_t p0, p1;
+        memcpy(&p0, p, sizeof(uint64_t));
+        memcpy(&p1, p + w, sizeof(uint64_t));
+        return bilerp(p0, p1, fx, fy);
+    }
+    int x0 = edge_index(x, w, edge), x1 = edge_index(x + 1, w, edge);
+    const uint32_t *r0 = simage_row_ptr(tex, edge_index(y, h, edge)), *r1 = simage_row_ptr(tex, edge_index(y + 1, h, edge));
+    return bilerp((uint64_t)r0[x1] << 32 | r0[x0], (uint64_t)r1[x1] << 32 | r1[x0], fx, fy);
+}
+
+static inline uint32_t shade_channel(float c) {
+    return (uint32_t)(_CLAMP(c, 0.f, 255.f) + .5f);
+}
+
+#if defined(SIMAGE_SSE2)
+static inline __m128 plane4(float a, float d, __m128 at) {
+    return _mm_add_ps(_mm_set1_ps(a), _mm_mul_ps(_mm_set1_ps(d), at));
+}
+
+static inline __m128i shade_channel4(__m128 c) {
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(255.f)), _mm_set1_ps(.5f)));
+}
+
+static inline __m128 texel_channel4(__m128i t, int shift) {
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(t, shift), _mm_set1_epi32(0xFF))), _mm_set1_ps(1.f / 255.f));
+}
+
+// The first `count` of four pixels, offset is the distance of the first from the plane origin
+static inline void shade4(const shade_t *s, const float *a, int offset, int count, uint32_t *out, float *zf, uint16_t *zh) {
+    const float *d = s->dx;
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 t = _mm_add_ps(_mm_set1_ps((float)offset), _mm_setr_ps(0.f, 1.f, 2.f, 3.f));
+    __m128 z = plane4(a[ATTR_Z], d[ATTR_Z], t);
+    __m128i keep = _mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(count));
+    __m128i zq = _mm_setzero_si128(), old_z = _mm_setzero_si128();
+    if (zf) {
+        old_z = _mm_loadu_si128((const __m128i*)zf);
+        keep = _mm_and_si128(keep, _mm_castps_si128(_mm_cmplt_ps(z, _mm_castsi128_ps(old_z))));
+    } else if (zh) {
+        zq = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(z, _mm_setzero_ps()), one), _mm_set1_ps(65535.f)), _mm_set1_ps(.5f)));
+        old_z = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)zh), _mm_setzero_si128());
+        keep = _mm_and_si128(keep, _mm_cmplt_epi32(zq, old_z));
+    }
+    if (!_mm_movemask_epi8(keep))
+        return;
+    __m128 w = _mm_div_ps(one, plane4(a[ATTR_Q], d[ATTR_Q], t));
+    __m128 r = _mm_mul_ps(plane4(a[ATTR_R], d[ATTR_R], t), w), g = _mm_mul_ps(plane4(a[ATTR_G], d[ATTR_G], t), w);
+    __m128 b = _mm_mul_ps(plane4(a[ATTR_B], d[ATTR_B], t), w), alpha = _mm_mul_ps(plane4(a[ATTR_A], d[ATTR_A], t), w);
+    if (s->texture) {
+        float u[4], v[4];
+        uint32_t texels[4];
+        int live = _mm_movemask_ps(_mm_castsi128_ps(keep));
+        _mm_storeu_ps(u, _mm_mul_ps(plane4(a[ATTR_U], d[ATTR_U], t), w));
+        _mm_storeu_ps(v, _mm_mul_ps(plane4(a[ATTR_V], d[ATTR_V], t), w));
+        for (int l = 0; l < 4; l++)
+            texels[l] = live >> l & 1 ? texture_sample(s, u[l], v[l]) : 0;
+        __m128i tex = _mm_loadu_si128((const __m128i*)texels);
+        keep = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(tex, _mm_set1_epi32(0xFF)), _mm_setzero_si128()), keep);
+        r = _mm_mul_ps(r, texel_channel4(tex, 24));
+        b = _mm_mul_ps(b, texel_channel4(tex, 16));
+        g = _mm_mul_ps(g, texel_channel4(tex, 8));
+        alpha = _mm_mul_ps(alpha, texel_channel4(tex, 0));
+    }
+    __m128i px = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(shade_channel4(r), 24), _mm_slli_epi32(shade_channel4(b), 16)),
+                              _mm_or_si128(_mm_slli_epi32(shade_channel4(g), 8), shade_channel4(alpha)));
+    __m128i old = _mm_loadu_si128((const __m128i*)out);
+    _mm_storeu_si128((__m128i*)out, _mm_or_si128(_mm_and_si128(keep, px), _mm_andnot_si128(keep, old)));
+    if (zf)
+        _mm_storeu_si128((__m128i*)zf, _mm_or_si128(_mm_and_si128(keep, _mm_castps_si128(z)), _mm_andnot_si128(keep, old_z)));
+    else if (zh) {
+        // No unsigned saturating 32 -> 16 bit pack in SSE2, biased into the signed range instead
+        __m128i merged = _mm_sub_epi32(_mm_or_si128(_mm_and_si128(keep, zq), _mm_andnot_si128(keep, old_z)), _mm_set1_epi32(0x8000));
+        _mm_storel_epi64((__m128i*)zh, _mm_xor_si128(_mm_packs_epi32(merged, merged), _mm_set1_epi16((short)0x8000)));
+    }
+}
+#elif defined(SIMAGE_NEON)
+static inline float32x4_t plane4(float a, float d, float32x4_t at) {
+    return vmlaq_n_f32(vdupq_n_f32(a), at, d);
+}
+
+static inline uint32x4_t shade_channel4(float32x4_t c) {
+    return vcvtq_u32_f32(vaddq_f32(vminq_f32(vmaxq_f32(c, vdupq_n_f32(0.f)), vdupq_n_f32(255.f)), vdupq_n_f32(.5f)));
+}
+
+static inline float32x4_t texel_channel4(uint32x4_t t, int shift) {
+    uint32x4_t c = vandq_u32(vshlq_u32(t, vdupq_n_s32(-shift)), vdupq_n_u32(0xFF));
+    return vmulq_n_f32(vcvtq_f32_u32(c), 1.f / 255.f);
+}
+
+// The first `count` of four pixels, offset is the distance of the first from the plane origin
+static inline void shade4(const shade_t *s, const float *a, int offset, int count, uint32_t *out, float *zf, uint16_t *zh) {
+    static const float offsets[4] = {0.f, 1.f, 2.f, 3.f};
+    static const uint32_t indices[4] = {0, 1, 2, 3};
+    const float *d = s->dx;
+    float32x4_t t = vaddq_f32(vdupq_n_f32((float)offset), vld1q_f32(offsets));
+    float32x4_t z = plane4(a[ATTR_Z], d[ATTR_Z], t);
+    uint32x4_t keep = vcltq_u32(vld1q_u32(indices), vdupq_n_u32((uint32_t)count)), zq = vdupq_n_u32(0), old_z = vdupq_n_u32(0);
+    if (zf) {
+        old_z = vreinterpretq_u32_f32(vld1q_f32(zf));
+        keep = vandq_u32(keep, vcltq_f32(z, vreinterpretq_f32_u32(old_z)));
+    } else if (zh) {
+        zq = vcvtq_u32_f32(vaddq_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(z, vdupq_n_f32(0.f)), vdupq_n_f32(1.f)), 65535.f), vdupq_n_f32(.5f)));
+        old_z = vmovl_u16(vld1_u16(zh));
+        keep = vandq_u32(keep, vcltq_u32(zq, old_z));
+    }
+    uint32x2_t any = vorr_u32(vget_low_u32(keep), vget_high_u32(keep));
+    if (!(vget_lane_u32(any, 0) | vget_lane_u32(any, 1)))
+        return;
+    // Reciprocal estimate refined twice, ARMv7 has no vector divide
+    float32x4_t q = plane4(a[ATTR_Q], d[ATTR_Q], t), w = vrecpeq_f32(q);
+    w = vmulq_f32(w, vrecpsq_f32(q, w));
+    w = vmulq_f32(w, vrecpsq_f32(q, w));
+    float32x4_t r = vmulq_f32(plane4(a[ATTR_R], d[ATTR_R], t), w), g = vmulq_f32(plane4(a[ATTR_G], d[ATTR_G], t), w);
+    float32x4_t b = vmulq_f32(plane4(a[ATTR_B], d[ATTR_B], t), w), alpha = vmulq_f32(plane4(a[ATTR_A], d[ATTR_A], t), w);
+    if (s->texture) {
+        float u[4], v[4];
+        uint32_t texels[4], live[4];
+        vst1q_f32(u, vmulq_f32(plane4(a[ATTR_U], d[ATTR_U], t), w));
+        vst1q_f32(v, vmulq_f32(plane4(a[ATTR_V], d[ATTR_V], t), w));
+        vst1q_u32(live, keep);
+        for (int l = 0; l < 4; l++)
+            texels[l] = live[l] ? texture_sample(s, u[l], v[l]) : 0;
+        uint32x4_t tex = vld1q_u32(texels);
+        keep = vandq_u32(keep, vtstq_u32(tex, vdupq_n_u32(0xFF)));
+        r = vmulq_f32(r, texel_channel4(tex, 24));
+        b = vmulq_f32(b, texel_channel4(tex, 16));
+        g = vmulq_f32(g, texel_channel4(tex, 8));
+        alpha = vmulq_f32(alpha, texel_channel4(tex, 0));
+    }
+    uint32x4_t px = vorrq_u32(vorrq_u32(vshlq_n_u32(shade_channel4(r), 24), vshlq_n_u32(shade_channel4(b), 16)),
+                              vorrq_u32(vshlq_n_u32(shade_channel4(g), 8), shade_channel4(alpha)));
+    vst1q_u32(out, vbslq_u32(keep, px, vld1q_u32(out)));
+    if (zf)
+        vst1q_f32(zf, vreinterpretq_f32_u32(vbslq_u32(keep, vreinterpretq_u32_f32(z), old_z)));
+    else if (zh)
+        vst1_u16(zh, vmovn_u32(vbslq_u32(keep, zq, old_z)));
+}
+#endif
+
+static void shade_span(void *userdata, int y, int x, int n) {
+    const shade_t *s = (const shade_t*)userdata;
+    uint32_t *out = simage_row_ptr(s->img, y) + x;
+    size_t at = s->depth ? (size_t)y * s->depth->width + x : 0;
+    float *zf = s->depth && s->depth->bits == 32 ? (float*)s->depth->buffer + at : NULL;
+    uint16_t *zh = s->depth && s->depth->bits == 16 ? (uint16_t*)s->depth->buffer + at : NULL;
+    // Planes along the row, every pixel is evaluated from the same origin however the row is split
+    float a[ATTR_COUNT];
+    for (int k = 0; k < ATTR_COUNT; k++)
+        a[k] = s->base[k] + s->dy[k] * (float)(y - s->y);
+    int offset = x - s->x, i = 0;
+#if defined(SIMAGE_SSE2) || defined(SIMAGE_NEON)
+    for (; i + 4 <= n; i += 4)
+        shade4(s, a, offset + i, 4, out + i, zf ? zf + i : NULL, zh ? zh + i : NULL);
+    if (i < n) {
+        // The last pixels go through a copy so the vector loads stay inside the span
+        uint32_t tail[4] = {0};
+        float tail_f[4] = {0};
+        uint16_t tail_h[4] = {0};
+        int count = n - i;
+        memcpy(tail, out + i, count * sizeof(uint32_t));
+        if (zf)
+            memcpy(tail_f, zf + i, count * sizeof(float));
+        if (zh)
+            memcpy(tail_h, zh + i, count * sizeof(uint16_t));
+        shade4(s, a, offset + i, count, tail, zf ? tail_f : NULL, zh ? tail_h : NULL);
+        memcpy(out + i, tail, count * sizeof(uint32_t));
+        if (zf)
+            memcpy(zf + i, tail_f, count * sizeof(float));
+        if (zh)
+            memcpy(zh + i, tail_h, count * sizeof(uint16_t));
+    }
+#else
+    const float *d = s->dx;
+    for (; i < n; i++) {
+        float t = (float)(offset + i);
+        float z = a[ATTR_Z] + d[ATTR_Z] * t;
+        uint16_t zq = zh ? depth16(z) : 0;
+        if ((zf && !(z < zf[i])) || (zh && zq >= zh[i]))
+            continue;
+        float w = 1.f / (a[ATTR_Q] + d[ATTR_Q] * t);
+        float r = (a[ATTR_R] + d[ATTR_R] * t) * w, g = (a[ATTR_G] + d[ATTR_G] * t) * w;
+        float b = (a[ATTR_B] + d[ATTR_B] * t) * w, alpha = (a[ATTR_A] + d[ATTR_A] * t) * w;
+        if (s->texture) {
+            uint32_t tex = texture_sample(s, (a[ATTR_U] + d[ATTR_U] * t) * w, (a[ATTR_V] + d[ATTR_V] * t) * w);
+            if (!(tex & 0xFF))
+                continue;
+            r *= (float)(tex >> 24) * (1.f / 255.f);
+            b *= (float)(tex >> 16 & 0xFF) * (1.f / 255.f);
+            g *= (float)(tex >> 8 & 0xFF) * (1.f / 255.f);
+            alpha *= (float)(tex & 0xFF) * (1.f / 255.f);
+        }
+        out[i] = _RGBA(shade_channel(r), shade_channel(g), shade_channel(b), shade_channel(alpha));
+        if (zf)
+            zf[i] = z;
+        else if (zh)
+            zh[i] = zq;
+    }
+#endif
+}
+
+static void shade_triangle(simage_buffer *img, const draw_clip_t *clip, simage_depth *depth, const simage_vertex *vertices, simage_buffer *texture, simage_filter filter, simage_edge_mode edge) {
+    shade_t s = {
+        .img = img,
+        .texture = texture && texture->buffer ? texture : NULL,
+        .depth = depth && depth->buffer ? depth : NULL,
+        .filter = filter == SIMAGE_FILTER_NEAREST ? SIMAGE_FILTER_NEAREST : SIMAGE_FILTER_BILINEAR,
+        .edge = edge
+    };
+    int64_t v[6];
+    if ((texture && !s.texture) || !shade_setup(&s, vertices, v))
+        return;
+    draw_clip_t c = *clip;
+    if (s.depth) {
+        c.x1 = _MIN(c.x1, (int)s.depth->width);
+        c.y1 = _MIN(c.y1, (int)s.depth->height);
+    }
+    raster_triangle(&c, v, shade_span, &s);
+}
+
+typedef struct shade_job {
+    simage_buffer *img, *texture;
+    simage_depth *depth;
+    const simage_vertex *vertices;
+    simage_filter filter;
+    simage_edge_mode edge;
+    draw_clip_t clip;
+} shade_job_t;
+
+static void shade_rows(void *userdata, int begin, int end) {
+    shade_job_t *job = (shade_job_t*)userdata;
+    draw_clip_t band = {job->clip.x0, job->clip.y0 + begin, job->clip.x1, job->clip.y0 + end};
+    shade_triangle(job->img, &band, job->depth, job->vertices, job->texture, job->filter, job->edge);
+}
+
+// Bands of rows of the bounding box go to different threads
+static void draw_triangle_3d(simage_buffer *img, simage_depth *depth, const simage_vertex *vertices, simage_buffer *texture, simage_filter filter, simage_edge_mode edge) {
+    shade_job_t job = {
+        .img = img, .texture = texture, .depth = depth, .vertices = vertices,
+        .filter = filter, .edge = edge,
+        .clip = image_clip(img)
+    };
+    float min_x = fminf(fminf(vertices[0].x, vertices[1].x), vertices[2].x), max_x = fmaxf(fmaxf(vertices[0].x, vertices[1].x), vertices[2].x);
+    float min_y = fminf(fminf(vertices[0].y, vertices[1].y), vertices[2].y), max_y = fmaxf(fmaxf(vertices[0].y, vertices[1].y), vertices[2].y);
+    job.clip.x0 = _MAX(job.clip.x0, clamp_coord(floorf(min_x), -1, img->width));
+    job.clip.y0 = _MAX(job.clip.y0, clamp_coord(floorf(min_y), -1, img->height));
+    job.clip.x1 = _MIN(job.clip.x1, clamp_coord(ceilf(max_x) + 1.f, -1, img->width));
+    job.clip.y1 = _MIN(job.clip.y1, clamp_coord(ceilf(max_y) + 1.f, -1, img->height));
+    if (job.clip.x0 >= job.clip.x1 || job.clip.y0 >= job.clip.y1)
+        return;
+    // Sampling the image being drawn has to stay on one thread
+    int rows = job.clip.y1 - job.clip.y0;
+    size_t work = texture && texture->buffer == img->buffer ? 0 : (size_t)rows * (job.clip.x1 - job.clip.x0);
+    parallel_for(rows, work, shade_rows, &job);
+}
+
+void simage_draw_triangle_shaded(simage_buffer *img, simage_depth *depth, const simage_vertex vertices[3]) {
+    draw_triangle_3d(img, depth, vertices, NULL, SIMAGE_FILTER_NEAREST, SIMAGE_EDGE_CLAMP);
+}
+
+void simage_draw_triangle_textured(simage_buffer *img, simage_depth *depth, const simage_vertex vertices[3], simage_buffer *texture, simage_filter filter, simage_edge_mode edge) {
+    if (texture)
+        draw_triangle_3d(img, depth, vertices, texture, filter, edge);
+}
+
+// Blends color over a clipped span, opaque colors are stored directly
+static void blend_span(simage_buffer *img, const draw_clip_t *clip, int x, int y, int n, uint32_t color) {
+    if (y < clip->y0 || y >= clip->y1)
+        return;
+    if (x < clip->x0) {
+        n += x - clip->x0;
+        x = clip->x0;
+    }
+    n = _MIN(n, clip->x1 - x);
+    if (n <= 0)
+        return;
+    if ((color & 0xFF) == 0xFF && !linear_light) {
+        fill_row(simage_row_ptr(img, y) + x, n, color, false);
+        return;
+    }
+    uint32_t src[64], *row = simage_row_ptr(img, y) + x;
+    fill_row(src, _MIN(n, 64), color, false);
+    for (int i = 0; i < n; i += 64)
+        blend_row(row + i, src, _MIN(n - i, 64), SIMAGE_BLEND_ALPHA);
+}
+
+static inline void plot_coverage(simage_buffer *img, const draw_clip_t *clip, int x, int y, uint32_t color, uint32_t coverage) {
+    if (x < clip->x0 || y < clip->y0 || x >= clip->x1 || y >= clip->y1 || !coverage)
+        return;
+    uint32_t *p = simage_row_ptr(img, y) + x, s = (color & 0xFFFFFF00) | div255((color & 0xFF) * _MIN(coverage, 255));
+    *p = linear_light ? blend_pixel_linear(s, *p, SIMAGE_BLEND_ALPHA) : blend_pixel(s, *p, SIMAGE_BLEND_ALPHA);
+}
+
+/* cov holds 0..256 per pixel of a row starting at x, runs of full coverage are blended as
+   spans and the rest pixel by pixel */
+static void blend_coverage(simage_buffer *img, const draw_clip_t *clip, int x, int y, const uint16_t *cov, int n, uint32_t color) {
+    if (y < clip->y0 || y >= clip->y1)
+        return;
+    int i = _MAX(clip->x0 - x, 0);
+    n = _MIN(n, clip->x1 - x);
+    while (i < n) {
+        if (cov[i] >= 256) {
+            int j = i;
+            while (j < n && cov[j] >= 256)
+                j++;
+            blend_span(img, clip, x + i, y, j - i, color);
+            i = j;
+        } else {
+            plot_coverage(img, clip, x + i, y, color, (cov[i] * 255u + 128) >> 8);
+            i++;
+        }
+    }
+}
+
+static inline void swap_float(float *a, float *b) {
+    float t = *a;
+    *a = *b;
+    *b = t;
+}
+
+/* Columns of an anti-aliased line cover two pixels across its minor axis, 0..256 each. Runs of
+   columns on the same pair of rows are gathered and blended as two coverage rows */
+typedef struct line_run {
+    bool steep;
+    int x, y, n;
+    uint16_t cov[2][64];
+} line_run_t;
+
+static void line_flush(simage_buffer *img, const draw_clip_t *clip, line_run_t *run, uint32_t color) {
+    if (run->n) {
+        blend_coverage(img, clip, run->x, run->y, run->cov[0], run->n, color);
+        blend_coverage(img, clip, run->x, run->y + 1, run->cov[1], run->n, color);
+    }
+    run->n = 0;
+}
+
+static void line_column(simage_buffer *img, const draw_clip_t *clip, line_run_t *run, int x, int y, uint32_t c0, uint32_t c1, uint32_t color) {
+    if (run->steep) {
+        // Both pixels of a steep line's column share an image row
+        uint16_t cov[2] = { (uint16_t)c0, (uint16_t)c1 };
+        blend_coverage(img, clip, y, x, cov, 2, color);
+        return;
+    }
+    if (run->n && (y != run->y || x != run->x + run->n || run->n == 64))
+        line_flush(img, clip, run, color);
+    if (!run->n) {
+        run->x = x;
+        run->y = y;
+    }
+    run->cov[0][run->n] = (uint16_t)c0;
+    run->cov[1][run->n++] = (uint16_t)c1;
+}
+
+static void draw_line_aa(simage_buffer *img, const draw_clip_t *clip, float x0, float y0, float x1, float y1, uint32_t color) {
+    bool steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+    if (steep) {
+        swap_float(&x0, &y0);
+        swap_float(&x1, &y1);
+    }
+    if (x0 > x1) {
+        swap_float(&x0, &x1);
+        swap_float(&y0, &y1);
+    }
+    int w = steep ? img->height : img->width, h = steep ? img->width : img->height;
+    float dx = x1 - x0, gradient = dx < 1e-6f ? 1.f : (y1 - y0) / dx;
+    // Clip along the major axis just outside the image, then reject lines that miss it
+    if (x0 < -2.f) {
+        y0 += gradient * (-2.f - x0);
+        x0 = -2.f;
+    }
+    if (x1 > w + 2.f) {
+        y1 -= gradient * (x1 - w - 2.f);
+        x1 = w + 2.f;
+    }
+    if (x1 < x0 || fmaxf(y0, y1) < -2.f || fminf(y0, y1) > h + 2.f)
+        return;
+    line_run_t run = { .steep = steep };
+    // Wu's algorithm, the end points cover their pixel by how much of it the line reaches
+    int ends[2] = {(int)floorf(x0 + .5f), (int)floorf(x1 + .5f)}, rows[2];
+    uint32_t cover[2][2];
+    for (int e = 0; e < 2; e++) {
+        float x = e ? x1 : x0, y = e ? y1 : y0;
+        float xend = (float)ends[e], yend = y + gradient * (xend - x);
+        float gap = e ? x + .5f - xend : 1.f - (x + .5f - xend);
+        if (e && ends[1] == ends[0]) {
+            // Both ends in one column, which the line only crosses part of
+            gap = x1 - x0;
+            yend = (y0 + y1) * .5f + gradient * (xend - (x0 + x1) * .5f);
+        }
+        float f = yend - floorf(yend);
+        rows[e] = (int)floorf(yend);
+        cover[e][0] = (uint32_t)lroundf((1.f - f) * gap * 256.f);
+        cover[e][1] = (uint32_t)lroundf(f * gap * 256.f);
+    }
+    int first = _MAX(ends[0] + 1, -1), last = _MIN(ends[1] - 1, w);
+    if (ends[0] != ends[1])
+        line_column(img, clip, &run, ends[0], rows[0], cover[0][0], cover[0][1], color);
+    if (first <= last) {
+        // 16.16 fixed point row position, its fraction is the coverage of the lower pixel
+        int64_t y = llroundf((y0 + gradient * (first - x0)) * 65536.f), dy = llroundf(gradient * 65536.f);
+        // Only the stepping is limited to the clip, so every pixel lands where the full line puts it
+        int lo = steep ? clip->y0 : clip->x0, hi = steep ? clip->y1 : clip->x1;
+        if (first < lo) {
+            y += dy * (lo - first);
+            first = lo;
+        }
+        last = _MIN(last, hi - 1);
+        for (int x = first; x <= last; x++, y += dy) {
+            uint32_t f = (uint32_t)(y >> 8) & 0xFF;
+            line_column(img, clip, &run, x, (int)(y >> 16), 256 - f, f, color);
+        }
+    }
+    line_column(img, clip, &run, ends[1], rows[1], cover[1][0], cover[1][1], color);
+    line_flush(img, clip, &run, color);
+}
+
+void simage_draw_line_aa(simage_buffer *img, float x0, float y0, float x1, float y1, sg_color color) {
+    draw_clip_t clip = image_clip(img);
+    draw_line_aa(img, &clip, x0, y0, x1, y1, sg_color_to_int(color));
+}
+
+#define _AA_SUBSAMPLES 16
+
+// Adds the coverage of [a, b) to a row of _AA_SUBSAMPLES weighted cells starting at x0
+static void add_coverage(uint16_t *cov, int x0, int n, float a, float b) {
+    a = fmaxf(a - x0, 0.f);
+    b = fminf(b - x0, (float)n);
+    if (a >= b)
+        return;
+    int ia = (int)a, ib = (int)b;
+    if (ia == ib) {
+        cov[ia] += (uint16_t)lroundf((b - a) * (256 / _AA_SUBSAMPLES));
+        return;
+    }
+    cov[ia] += (uint16_t)lroundf((ia + 1 - a) * (256 / _AA_SUBSAMPLES));
+    for (int i = ia + 1; i < ib; i++)
+        cov[i] += 256 / _AA_SUBSAMPLES;
+    if (ib < n)
+        cov[ib] += (uint16_t)lroundf((b - ib) * (256 / _AA_SUBSAMPLES));
+}
+
+/* Each row is sampled on _AA_SUBSAMPLES scanlines, each contributing its exact horizontal
+   extent. Outlines are one pixel wide rings between the radii -0.5 and +0.5 */
+static void draw_ellipse_aa(simage_buffer *img, const draw_clip_t *clip, float cx, float cy, float rx, float ry, uint32_t color, bool fill) {
+    float pad = fill ? 0.f : .5f;
+    float ox = fabsf(rx) + pad, oy = fabsf(ry) + pad, ix = fabsf(rx) - pad, iy = fabsf(ry) - pad;
+    // Integer coordinates are pixel centers
+    cx += .5f;
+    cy += .5f;
+    int x0 = _MAX((int)floorf(cx - ox), clip->x0), x1 = _MIN((int)ceilf(cx + ox), clip->x1);
+    int y0 = _MAX((int)floorf(cy - oy), clip->y0), y1 = _MIN((int)ceilf(cy + oy), clip->y1);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    int n = x1 - x0;
+    uint16_t *cov = malloc(n * sizeof(uint16_t));
+    if (!cov)
+        return;
+    for (int y = y0; y < y1; y++) {
+        memset(cov, 0, n * sizeof(uint16_t));
+        int lo = n, hi = 0;
+        for (int s = 0; s < _AA_SUBSAMPLES; s++) {
+            float dy = y + (s + .5f) / _AA_SUBSAMPLES - cy;
+            if (fabsf(dy) >= oy)
+                continue;
+            float outer = ox * sqrtf(1.f - dy * dy / (oy * oy));
+            float inner = !fill && ix > 0.f && iy > 0.f && fabsf(dy) < iy ? ix * sqrtf(1.f - dy * dy / (iy * iy)) : -1.f;
+            if (inner > 0.f) {
+                add_coverage(cov, x0, n, cx - outer, cx - inner);
+                add_coverage(cov, x0, n, cx + inner, cx + outer);
+            } else
+                add_coverage(cov, x0, n, cx - outer, cx + outer);
+            lo = _MIN(lo, _MAX((int)floorf(cx - outer) - x0, 0));
+            hi = _MAX(hi, _MIN((int)ceilf(cx + outer) - x0, n));
+        }
+        if (lo < hi)
+            blend_coverage(img, clip, x0 + lo, y, cov + lo, hi - lo, color);
+    }
+    free(cov);
+}
+
+void simage_draw_circle_aa(simage_buffer *img, float xc, float yc, float r, sg_color color, int fill) {
+    draw_clip_t clip = image_clip(img);
+    draw_ellipse_aa(img, &clip, xc, yc, r, r, sg_color_to_int(color), fill);
+}
+
+void simage_draw_ellipse_aa(simage_buffer *img, float xc, float yc, float rx, float ry, sg_color color, int fill) {
+    draw_clip_t clip = image_clip(img);
+    draw_ellipse_aa(img, &clip, xc, yc, rx, ry, sg_color_to_int(color), fill);
+}
+
+/* Scanline polygon fill with a sorted edge table and an active edge list. Coordinates are
+   moved so pixel (x, y) covers [x, x + 1) x [y, y + 1), each row is sampled on `samples`
+   scanlines which are either point sampled (1) or accumulated into coverage (AA) */
+typedef struct poly_edge {
+    float x0, y0, y1, dxdy;
+    int dir;
+} poly_edge_t;
+
+static int compare_edges(const void *a, const void *b) {
+    float ya = ((const poly_edge_t*)a)->y0, yb = ((const poly_edge_t*)b)->y0;
+    return (ya > yb) - (ya < yb);
+}
+
+static void fill_polygon(simage_buffer *img, const draw_clip_t *clip, const float *points, int n, simage_fill_rule rule, uint32_t color, bool aa) {
+    if (n < 3)
+        return;
+    poly_edge_t *edges = malloc(n * sizeof(poly_edge_t));
+    int *active = malloc(n * sizeof(int));
+    float *xs = malloc(n * sizeof(float));
+    uint16_t *cov = aa ? malloc(img->width * sizeof(uint16_t)) : NULL;
+    float min_x = INFINITY, max_x = -INFINITY, min_y = INFINITY, max_y = -INFINITY;
+    int count = 0;
+    if (!edges || !active || !xs || (aa && !cov))
+        goto BAIL;
+    for (int i = 0; i < n; i++) {
+        float ax = points[i * 2] + .5f, ay = points[i * 2 + 1] + .5f;
+        float bx = points[(i + 1) % n * 2] + .5f, by = points[(i + 1) % n * 2 + 1] + .5f;
+        min_x = fminf(min_x, ax);
+        max_x = fmaxf(max_x, ax);
+        min_y = fminf(min_y, ay);
+        max_y = fmaxf(max_y, ay);
+        if (ay == by)
+            continue;
+        poly_edge_t *e = &edges[count++];
+        e->dir = ay < by ? 1 : -1;
+        if (ay > by) {
+            swap_float(&ax, &bx);
+            swap_float(&ay, &by);
+        }
+        e->x0 = ax;
+        e->y0 = ay;
+        e->y1 = by;
+        e->dxdy = (bx - ax) / (by - ay);
+    }
+    int x_lo = (int)_CLAMP(floorf(min_x), 0.f, (float)img->width), x_hi = (int)_CLAMP(ceilf(max_x), 0.f, (float)img->width);
+    int y_lo = (int)_CLAMP(floorf(min_y), 0.f, (float)img->height), y_hi = (int)_CLAMP(ceilf(max_y), 0.f, (float)img->height);
+    x_lo = _MAX(x_lo, clip->x0);
+    x_hi = _MIN(x_hi, clip->x1);
+    y_lo = _MAX(y_lo, clip->y0);
+    y_hi = _MIN(y_hi, clip->y1);
+    if (!count || x_lo >= x_hi || y_lo >= y_hi)
+        goto BAIL;
+    qsort(edges, count, sizeof(poly_edge_t), compare_edges);
+    int samples = aa ? _AA_SUBSAMPLES : 1, next = 0, live = 0;
+    for (int y = y_lo; y < y_hi; y++) {
+        int lo = x_hi, hi = x_lo;
+        if (aa)
+            memset(cov + x_lo, 0, (x_hi - x_lo) * sizeof(uint16_t));
+        for (int s = 0; s < samples; s++) {
+            float sy = y + (s + .5f) / samples;
+            // Edges are active on [y0, y1)
+            while (next < count && edges[next].y0 <= sy)
+                active[live++] = next++;
+            int k = 0;
+            for (int i = 0; i < live; i++)
+                if (edges[active[i]].y1 > sy)
+                    active[k++] = active[i];
+            live = k;
+            // Crossings stay nearly sorted from one scanline to the next, insertion sort them
+            for (int i = 0; i < live; i++) {
+                poly_edge_t *e = &edges[active[i]];
+                float x = e->x0 + (sy - e->y0) * e->dxdy;
+                int j = i, idx = active[i];
+                for (; j > 0 && xs[j - 1] > x; j--) {
+                    xs[j] = xs[j - 1];
+                    active[j] = active[j - 1];
+                }
+                xs[j] = x;
+                active[j] = idx;
+            }
+            int winding = 0;
+            for (int i = 0; i + 1 < live; i++) {
+                winding += rule == SIMAGE_FILL_EVEN_ODD ? 1 : edges[active[i]].dir;
+                bool inside = rule == SIMAGE_FILL_EVEN_ODD ? (winding & 1) : winding != 0;
+                float l = fmaxf(xs[i], (float)x_lo - 1.f), r = fminf(xs[i + 1], (float)x_hi + 1.f);
+                if (!inside || r <= l)
+                    continue;
+                if (aa) {
+                    add_coverage(cov + x_lo, x_lo, x_hi - x_lo, l, r);
+                    lo = _MIN(lo, (int)floorf(l));
+                    hi = _MAX(hi, (int)ceilf(r));
+                } else {
+                    // Pixels whose centers are inside [l, r)
+                    int a = _MAX((int)ceilf(l - .5f), x_lo), b = _MIN((int)ceilf(r - .5f), x_hi);
+                    if (a < b)
+                        blend_span(img, clip, a, y, b - a, color);
+                }
+            }
+        }
+        lo = _MAX(lo, x_lo);
+        hi = _MIN(hi, x_hi);
+        if (aa && lo < hi)
+            blend_coverage(img, clip, lo, y, cov + lo, hi - lo, color);
+    }
+BAIL:
+    free(edges);
+    free(active);
+    free(xs);
+    free(cov);
+}
+
+void simage_fill_polygon(simage_buffer *img, const float *points, int n, simage_fill_rule rule, sg_color color) {
+    draw_clip_t clip = image_clip(img);
+    fill_polygon(img, &clip, points, n, rule, sg_color_to_int(color), false);
+}
+
+void simage_fill_polygon_aa(simage_buffer *img, const float *points, int n, simage_fill_rule rule, sg_color color) {
+    draw_clip_t clip = image_clip(img);
+    fill_polygon(img, &clip, points, n, rule, sg_color_to_int(color), true);
+}
+
+typedef enum canvas_op {
+    CANVAS_LINE,
+    CANVAS_CIRCLE,
+    CANVAS_RECTANGLE,
+    CANVAS_TRIANGLE,
+    CANVAS_LINE_AA,
+    CANVAS_ELLIPSE_AA,
+    CANVAS_POLYGON,
+    CANVAS_BLIT,
+    CANVAS_TRIANGLE_3D
+} canvas_op;
+
+typedef struct canvas_cmd {
+    canvas_op op;
+    uint32_t color;
+    bool fill;
+    union {
+        int i[6];
+        float f[4];
+        struct {
+            size_t first;
+            int n;
+            simage_fill_rule rule;
+        } poly;
+        simage_blit_cmd blit;
+        // The vertices are kept in the point array
+        struct {
+            size_t first;
+            simage_buffer *texture;
+            simage_depth *depth;
+            simage_filter filter;
+            simage_edge_mode edge;
+        } mesh;
+    } u;
+} canvas_cmd_t;
+
+void simage_canvas_init(simage_canvas *canvas, simage_buffer *target) {
+    memset(canvas, 0, sizeof(simage_canvas));
+    canvas->target = target;
+}
+
+void simage_canvas_destroy(simage_canvas *canvas) {
+    free(canvas->commands);
+    free(canvas->points);
+    memset(canvas, 0, sizeof(simage_canvas));
+}
+
+static canvas_cmd_t* canvas_push(simage_canvas *canvas, canvas_op op, uint32_t color, bool fill) {
+    if (canvas->count == canvas->capacity) {
+        size_t capacity = canvas->capacity ? canvas->capacity * 2 : 256;
+        canvas_cmd_t *commands = realloc(canvas->commands, capacity * sizeof(canvas_cmd_t));
+        if (!commands)
+            return NULL;
+        canvas->commands = commands;
+        canvas->capacity = capacity;
     }
+    canvas_cmd_t *cmd = (canvas_cmd_t*)canvas->commands + canvas->count++;
+    memset(cmd, 0, sizeof(canvas_cmd_t));
+    cmd->op = op;
+    cmd->color = color;
+    cmd->fill = fill;
+    return cmd;
+}
 
-    w += x;
-    h += y;
-    if (w < 0 || h < 0 || x > img->width || y > img->height)
-        return;
+bool simage_canvas_line(simage_canvas *canvas, int x0, int y0, int x1, int y1, sg_color color) {
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_LINE, sg_color_to_int(color), false);
+    if (cmd)
+        memcpy(cmd->u.i, (int[4]){x0, y0, x1, y1}, 4 * sizeof(int));
+    return cmd != NULL;
+}
 
-    if (w > img->width)
-        w = img->width;
-    if (h > img->height)
-        h = img->height;
+bool simage_canvas_circle(simage_canvas *canvas, int xc, int yc, int r, sg_color color, int fill) {
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_CIRCLE, sg_color_to_int(color), fill);
+    if (cmd)
+        memcpy(cmd->u.i, (int[3]){xc, yc, r}, 3 * sizeof(int));
+    return cmd != NULL;
+}
 
-    if (fill) {
-        for (; y < h; ++y)
-            hline(img, y, x, w, color);
+bool simage_canvas_rectangle(simage_canvas *canvas, int x, int y, int w, int h, sg_color color, int fill) {
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_RECTANGLE, sg_color_to_int(color), fill);
+    if (cmd)
+        memcpy(cmd->u.i, (int[4]){x, y, w, h}, 4 * sizeof(int));
+    return cmd != NULL;
+}
+
+bool simage_canvas_triangle(simage_canvas *canvas, int x0, int y0, int x1, int y1, int x2, int y2, sg_color color, int fill) {
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_TRIANGLE, sg_color_to_int(color), fill);
+    if (cmd)
+        memcpy(cmd->u.i, (int[6]){x0, y0, x1, y1, x2, y2}, 6 * sizeof(int));
+    return cmd != NULL;
+}
+
+bool simage_canvas_line_aa(simage_canvas *canvas, float x0, float y0, float x1, float y1, sg_color color) {
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_LINE_AA, sg_color_to_int(color), false);
+    if (cmd)
+        memcpy(cmd->u.f, (float[4]){x0, y0, x1, y1}, 4 * sizeof(float));
+    return cmd != NULL;
+}
+
+bool simage_canvas_circle_aa(simage_canvas *canvas, float xc, float yc, float r, sg_color color, int fill) {
+    return simage_canvas_ellipse_aa(canvas, xc, yc, r, r, color, fill);
+}
+
+bool simage_canvas_ellipse_aa(simage_canvas *canvas, float xc, float yc, float rx, float ry, sg_color color, int fill) {
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_ELLIPSE_AA, sg_color_to_int(color), fill);
+    if (cmd)
+        memcpy(cmd->u.f, (float[4]){xc, yc, rx, ry}, 4 * sizeof(float));
+    return cmd != NULL;
+}
+
+static bool canvas_reserve(simage_canvas *canvas, size_t n) {
+    if (canvas->point_count + n > canvas->point_capacity) {
+        size_t capacity = _MAX(canvas->point_capacity * 2, canvas->point_count + n);
+        float *grown = realloc(canvas->points, capacity * sizeof(float));
+        if (!grown)
+            return false;
+        canvas->points = grown;
+        canvas->point_capacity = capacity;
+    }
+    return true;
+}
+
+bool simage_canvas_polygon(simage_canvas *canvas, const float *points, int n, simage_fill_rule rule, sg_color color, bool aa) {
+    if (n < 3)
+        return true;
+    if (!canvas_reserve(canvas, (size_t)n * 2))
+        return false;
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_POLYGON, sg_color_to_int(color), aa);
+    if (!cmd)
+        return false;
+    memcpy(canvas->points + canvas->point_count, points, n * 2 * sizeof(float));
+    cmd->u.poly.first = canvas->point_count;
+    cmd->u.poly.n = n;
+    cmd->u.poly.rule = rule;
+    canvas->point_count += n * 2;
+    return true;
+}
+
+bool simage_canvas_blit(simage_canvas *canvas, const simage_blit_cmd *blit) {
+    if (!blit->src)
+        return true;
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_BLIT, 0, false);
+    if (cmd)
+        cmd->u.blit = *blit;
+    return cmd != NULL;
+}
+
+static bool canvas_triangle_3d(simage_canvas *canvas, simage_depth *depth, const simage_vertex *vertices, simage_buffer *texture, simage_filter filter, simage_edge_mode edge) {
+    size_t n = 3 * sizeof(simage_vertex) / sizeof(float);
+    if (!canvas_reserve(canvas, n))
+        return false;
+    canvas_cmd_t *cmd = canvas_push(canvas, CANVAS_TRIANGLE_3D, 0, false);
+    if (!cmd)
+        return false;
+    memcpy(canvas->points + canvas->point_count, vertices, 3 * sizeof(simage_vertex));
+    cmd->u.mesh.first = canvas->point_count;
+    cmd->u.mesh.texture = texture;
+    cmd->u.mesh.depth = depth;
+    cmd->u.mesh.filter = filter;
+    cmd->u.mesh.edge = edge;
+    canvas->point_count += n;
+    return true;
+}
+
+bool simage_canvas_triangle_shaded(simage_canvas *canvas, simage_depth *depth, const simage_vertex vertices[3]) {
+    return canvas_triangle_3d(canvas, depth, vertices, NULL, SIMAGE_FILTER_NEAREST, SIMAGE_EDGE_CLAMP);
+}
+
+bool simage_canvas_triangle_textured(simage_canvas *canvas, simage_depth *depth, const simage_vertex vertices[3], simage_buffer *texture, simage_filter filter, simage_edge_mode edge) {
+    return !texture || canvas_triangle_3d(canvas, depth, vertices, texture, filter, edge);
+}
+
+// Conservative destination rectangle of a command, false if it can't touch the target
+static bool canvas_bounds(simage_canvas *canvas, const canvas_cmd_t *cmd, draw_clip_t *r) {
+    simage_buffer *img = canvas->target;
+    int w = img->width, h = img->height;
+    const int *i = cmd->u.i;
+    const float *f = cmd->u.f;
+    int64_t x0, y0, x1, y1;
+    switch (cmd->op) {
+        case CANVAS_LINE:
+            x0 = _MIN(i[0], i[2]);
+            y0 = _MIN(i[1], i[3]);
+            x1 = (int64_t)_MAX(i[0], i[2]) + 1;
+            y1 = (int64_t)_MAX(i[1], i[3]) + 1;
+            break;
+        case CANVAS_CIRCLE:
+            x0 = (int64_t)i[0] - abs(i[2]);
+            y0 = (int64_t)i[1] - abs(i[2]);
+            x1 = (int64_t)i[0] + abs(i[2]) + 1;
+            y1 = (int64_t)i[1] + abs(i[2]) + 1;
+            break;
+        case CANVAS_RECTANGLE:
+            x0 = _MIN((int64_t)i[0], (int64_t)i[0] + i[2]);
+            y0 = _MIN((int64_t)i[1], (int64_t)i[1] + i[3]);
+            x1 = _MAX((int64_t)i[0], (int64_t)i[0] + i[2]) + 1;
+            y1 = _MAX((int64_t)i[1], (int64_t)i[1] + i[3]) + 1;
+            break;
+        case CANVAS_TRIANGLE:
+            x0 = _MIN(_MIN(i[0], i[2]), i[4]);
+            y0 = _MIN(_MIN(i[1], i[3]), i[5]);
+            x1 = (int64_t)_MAX(_MAX(i[0], i[2]), i[4]) + 1;
+            y1 = (int64_t)_MAX(_MAX(i[1], i[3]), i[5]) + 1;
+            break;
+        case CANVAS_LINE_AA:
+            x0 = clamp_coord(floorf(fminf(f[0], f[2])) - 2.f, -1, w);
+            y0 = clamp_coord(floorf(fminf(f[1], f[3])) - 2.f, -1, h);
+            x1 = clamp_coord(ceilf(fmaxf(f[0], f[2])) + 3.f, -1, w);
+            y1 = clamp_coord(ceilf(fmaxf(f[1], f[3])) + 3.f, -1, h);
+            break;
+        case CANVAS_ELLIPSE_AA:
+            x0 = clamp_coord(floorf(f[0] - fabsf(f[2])) - 1.f, -1, w);
+            y0 = clamp_coord(floorf(f[1] - fabsf(f[3])) - 1.f, -1, h);
+            x1 = clamp_coord(ceilf(f[0] + fabsf(f[2])) + 2.f, -1, w);
+            y1 = clamp_coord(ceilf(f[1] + fabsf(f[3])) + 2.f, -1, h);
+            break;
+        case CANVAS_POLYGON: {
+            const float *p = canvas->points + cmd->u.poly.first;
+            float min_x = INFINITY, max_x = -INFINITY, min_y = INFINITY, max_y = -INFINITY;
+            for (int k = 0; k < cmd->u.poly.n; k++) {
+                min_x = fminf(min_x, p[k * 2]);
+                max_x = fmaxf(max_x, p[k * 2]);
+                min_y = fminf(min_y, p[k * 2 + 1]);
+                max_y = fmaxf(max_y, p[k * 2 + 1]);
+            }
+            x0 = clamp_coord(floorf(min_x) - 1.f, -1, w);
+            y0 = clamp_coord(floorf(min_y) - 1.f, -1, h);
+            x1 = clamp_coord(ceilf(max_x) + 2.f, -1, w);
+            y1 = clamp_coord(ceilf(max_y) + 2.f, -1, h);
+            break;
+        }
+        case CANVAS_TRIANGLE_3D: {
+            simage_vertex v[3];
+            memcpy(v, canvas->points + cmd->u.mesh.first, sizeof(v));
+            x0 = clamp_coord(floorf(fminf(fminf(v[0].x, v[1].x), v[2].x)), -1, w);
+            y0 = clamp_coord(floorf(fminf(fminf(v[0].y, v[1].y), v[2].y)), -1, h);
+            x1 = clamp_coord(ceilf(fmaxf(fmaxf(v[0].x, v[1].x), v[2].x)) + 1.f, -1, w);
+            y1 = clamp_coord(ceilf(fmaxf(fmaxf(v[0].y, v[1].y), v[2].y)) + 1.f, -1, h);
+            break;
+        }
+        case CANVAS_BLIT: {
+            const simage_blit_cmd *c = &cmd->u.blit;
+            blit_t b;
+            if (!clip_blit(img, c->src, c->x, c->y, c->rx, c->ry, c->rw ? c->rw : (int)c->src->width, c->rh ? c->rh : (int)c->src->height, &b))
+                return false;
+            x0 = b.dx;
+            y0 = b.dy;
+            x1 = b.dx + b.w;
+            y1 = b.dy + b.h;
+            break;
+        }
+        default:
+            return false;
+    }
+    r->x0 = (int)_MAX(x0, 0);
+    r->y0 = (int)_MAX(y0, 0);
+    r->x1 = (int)_MIN(x1, (int64_t)w);
+    r->y1 = (int)_MIN(y1, (int64_t)h);
+    return r->x0 < r->x1 && r->y0 < r->y1;
+}
+
+static void canvas_run(simage_canvas *canvas, const canvas_cmd_t *cmd, const draw_clip_t *clip) {
+    simage_buffer *img = canvas->target;
+    const int *i = cmd->u.i;
+    const float *f = cmd->u.f;
+    switch (cmd->op) {
+        case CANVAS_LINE:
+            draw_line(img, clip, i[0], i[1], i[2], i[3], cmd->color);
+            break;
+        case CANVAS_CIRCLE:
+            draw_circle(img, clip, i[0], i[1], i[2], cmd->color, cmd->fill);
+            break;
+        case CANVAS_RECTANGLE:
+            draw_rectangle(img, clip, i[0], i[1], i[2], i[3], cmd->color, cmd->fill);
+            break;
+        case CANVAS_TRIANGLE:
+            draw_triangle(img, clip, i[0], i[1], i[2], i[3], i[4], i[5], cmd->color, cmd->fill);
+            break;
+        case CANVAS_LINE_AA:
+            draw_line_aa(img, clip, f[0], f[1], f[2], f[3], cmd->color);
+            break;
+        case CANVAS_ELLIPSE_AA:
+            draw_ellipse_aa(img, clip, f[0], f[1], f[2], f[3], cmd->color, cmd->fill);
+            break;
+        case CANVAS_POLYGON:
+            fill_polygon(img, clip, canvas->points + cmd->u.poly.first, cmd->u.poly.n, cmd->u.poly.rule, cmd->color, cmd->fill);
+            break;
+        case CANVAS_BLIT: {
+            const simage_blit_cmd *c = &cmd->u.blit;
+            blit_t a;
+            if (!clip_blit(img, c->src, c->x, c->y, c->rx, c->ry, c->rw ? c->rw : (int)c->src->width, c->rh ? c->rh : (int)c->src->height, &a))
+                break;
+            int x0 = _MAX(a.dx, clip->x0), y0 = _MAX(a.dy, clip->y0);
+            int x1 = _MIN(a.dx + a.w, clip->x1), y1 = _MIN(a.dy + a.h, clip->y1);
+            if (x0 >= x1 || y0 >= y1)
+                break;
+            blit_t b = {
+                .dx = x0, .dy = y0,
+                .sx = a.sx + x0 - a.dx, .sy = a.sy + y0 - a.dy,
+                .w = x1 - x0, .h = y1 - y0
+            };
+            blit_rows(img, c->src, &b, c->mode);
+            break;
+        }
+        case CANVAS_TRIANGLE_3D: {
+            simage_vertex v[3];
+            memcpy(v, canvas->points + cmd->u.mesh.first, sizeof(v));
+            shade_triangle(img, clip, cmd->u.mesh.depth, v, cmd->u.mesh.texture, cmd->u.mesh.filter, cmd->u.mesh.edge);
+            break;
+        }
+    }
+}
+
+typedef struct canvas_flush {
+    simage_canvas *canvas;
+    uint32_t *bins, *offsets;
+    int tiles_x;
+} canvas_flush_t;
+
+static void canvas_tiles(void *userdata, int begin, int end) {
+    canvas_flush_t *flush = (canvas_flush_t*)userdata;
+    simage_buffer *img = flush->canvas->target;
+    for (int t = begin; t < end; t++) {
+        int tx0 = (t % flush->tiles_x) * SIMAGE_BLIT_TILE, ty0 = (t / flush->tiles_x) * SIMAGE_BLIT_TILE;
+        draw_clip_t clip = {
+            tx0, ty0,
+            _MIN(tx0 + SIMAGE_BLIT_TILE, (int)img->width),
+            _MIN(ty0 + SIMAGE_BLIT_TILE, (int)img->height)
+        };
+        for (uint32_t i = flush->offsets[t]; i < flush->offsets[t + 1]; i++)
+            canvas_run(flush->canvas, (canvas_cmd_t*)flush->canvas->commands + flush->bins[i], &clip);
+    }
+}
+
+static void canvas_execute(simage_canvas *canvas) {
+    simage_buffer *dst = canvas->target;
+    canvas_cmd_t *cmds = (canvas_cmd_t*)canvas->commands;
+    size_t n = canvas->count;
+    int tiles_x = (int)((dst->width + SIMAGE_BLIT_TILE - 1) / SIMAGE_BLIT_TILE);
+    int tiles_y = (int)((dst->height + SIMAGE_BLIT_TILE - 1) / SIMAGE_BLIT_TILE);
+    size_t tiles = (size_t)tiles_x * tiles_y;
+    // Tiles are indexed with ints and commands with 32 bit bins, beyond that they run serially
+    bool binned = tiles < INT_MAX && n < UINT32_MAX;
+    canvas_flush_t flush = {
+        .canvas = canvas,
+        .tiles_x = tiles_x,
+        .offsets = binned ? calloc(tiles + 1, sizeof(uint32_t)) : NULL
+    };
+    draw_clip_t *bounds = binned ? malloc(n * sizeof(draw_clip_t)) : NULL;
+    size_t entries = 0, pixels = 0;
+    bool serial = !flush.offsets || !bounds;
+    for (size_t i = 0; !serial && i < n; i++) {
+        draw_clip_t *b = &bounds[i];
+        if (!canvas_bounds(canvas, &cmds[i], b)) {
+            b->x1 = b->x0;
+            continue;
+        }
+        // Tiles can't be processed independently when a blit or texture reads from the target
+        if ((cmds[i].op == CANVAS_BLIT && cmds[i].u.blit.src->buffer == dst->buffer) ||
+            (cmds[i].op == CANVAS_TRIANGLE_3D && cmds[i].u.mesh.texture && cmds[i].u.mesh.texture->buffer == dst->buffer))
+            serial = true;
+        for (int ty = b->y0 / SIMAGE_BLIT_TILE; ty <= (b->y1 - 1) / SIMAGE_BLIT_TILE; ty++)
+            for (int tx = b->x0 / SIMAGE_BLIT_TILE; tx <= (b->x1 - 1) / SIMAGE_BLIT_TILE; tx++, entries++)
+                flush.offsets[ty * tiles_x + tx + 1]++;
+        pixels += (size_t)(b->x1 - b->x0) * (b->y1 - b->y0);
+    }
+    if (!serial && (entries >= UINT32_MAX || !(flush.bins = malloc(_MAX(entries, 1) * sizeof(uint32_t)))))
+        serial = true;
+    if (serial) {
+        draw_clip_t clip = image_clip(dst);
+        for (size_t i = 0; i < n; i++)
+            canvas_run(canvas, &cmds[i], &clip);
+        goto BAIL;
+    }
+    for (size_t t = 0; t < tiles; t++)
+        flush.offsets[t + 1] += flush.offsets[t];
+    // Same order preserving binning as simage_blit_batch
+    for (size_t i = 0; i < n; i++) {
+        draw_clip_t *b = &bounds[i];
+        if (b->x0 >= b->x1)
+            continue;
+        for (int ty = b->y0 / SIMAGE_BLIT_TILE; ty <= (b->y1 - 1) / SIMAGE_BLIT_TILE; ty++)
+            for (int tx = b->x0 / SIMAGE_BLIT_TILE; tx <= (b->x1 - 1) / SIMAGE_BLIT_TILE; tx++)
+                flush.bins[flush.offsets[ty * tiles_x + tx]++] = (uint32_t)i;
+    }
+    for (size_t t = tiles; t > 0; t--)
+        flush.offsets[t] = flush.offsets[t - 1];
+    flush.offsets[0] = 0;
+    parallel_for((int)tiles, pixels, canvas_tiles, &flush);
+BAIL:
+    free(bounds);
+    free(flush.offsets);
+    free(flush.bins);
+}
+
+void simage_canvas_flush(simage_canvas *canvas) {
+    if (canvas->target && canvas->target->buffer && canvas->count)
+        canvas_execute(canvas);
+    canvas->count = 0;
+    canvas->point_count = 0;
+}
+
+/* TrueType reading for simage_font_from_ttf: cmap formats 0/4/6/12, simple and compound glyf
+   outlines, hmtx and the first 'kern' subtable when it is horizontal format 0. Offsets inside
+   the font are not bounds checked */
+typedef struct ttf_font_t {
+    const uint8_t *data;
+    uint32_t cmap, loca, glyf, hmtx, kern;
+    int glyphs, hmetrics, long_loca, cmap_format;
+    int ascent, descent, gap;
+} ttf_font_t;
+
+typedef struct ttf_edge_t {
+    float x0, y0, x1, y1;
+} ttf_edge_t;
+
+// Outline flattened into line segments in bitmap pixels
+typedef struct ttf_outline_t {
+    ttf_edge_t *edges;
+    size_t count, capacity;
+    bool failed;
+} ttf_outline_t;
+
+static inline uint16_t ttf_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline int16_t ttf_s16(const uint8_t *p) {
+    return (int16_t)ttf_u16(p);
+}
+
+static inline uint32_t ttf_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t ttf_table(const uint8_t *data, uint32_t font, const char *tag) {
+    int tables = ttf_u16(data + font + 4);
+    for (int i = 0; i < tables; i++) {
+        const uint8_t *record = data + font + 12 + 16 * i;
+        if (!memcmp(record, tag, 4))
+            return ttf_u32(record + 8);
+    }
+    return 0;
+}
+
+static bool ttf_init(ttf_font_t *f, const uint8_t *data) {
+    memset(f, 0, sizeof(ttf_font_t));
+    // Collections use their first font
+    uint32_t font = memcmp(data, "ttcf", 4) ? 0 : ttf_u32(data + 12);
+    if (ttf_u32(data + font) != 0x00010000 && memcmp(data + font, "true", 4))
+        return false;
+    uint32_t cmap = ttf_table(data, font, "cmap"), head = ttf_table(data, font, "head");
+    uint32_t hhea = ttf_table(data, font, "hhea"), maxp = ttf_table(data, font, "maxp");
+    f->loca = ttf_table(data, font, "loca");
+    f->glyf = ttf_table(data, font, "glyf");
+    f->hmtx = ttf_table(data, font, "hmtx");
+    f->kern = ttf_table(data, font, "kern");
+    if (!cmap || !head || !hhea || !maxp || !f->loca || !f->glyf || !f->hmtx)
+        return false;
+    f->data = data;
+    f->glyphs = ttf_u16(data + maxp + 4);
+    f->hmetrics = ttf_u16(data + hhea + 34);
+    f->long_loca = ttf_s16(data + head + 50) != 0;
+    f->ascent = ttf_s16(data + hhea + 4);
+    f->descent = ttf_s16(data + hhea + 6);
+    f->gap = ttf_s16(data + hhea + 8);
+    if (!f->hmetrics || f->ascent == f->descent)
+        return false;
+    // Unicode subtables, the full repertoire (format 12) over the BMP ones
+    int subtables = ttf_u16(data + cmap + 2), best = 0;
+    for (int i = 0; i < subtables; i++) {
+        const uint8_t *record = data + cmap + 4 + 8 * i;
+        int platform = ttf_u16(record), encoding = ttf_u16(record + 2);
+        uint32_t offset = cmap + ttf_u32(record + 4);
+        int format = ttf_u16(data + offset);
+        bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+        int rank = !unicode ? 0 : format == 12 ? 3 : format == 4 ? 2 : format == 0 || format == 6 ? 1 : 0;
+        if (rank > best) {
+            best = rank;
+            f->cmap = offset;
+            f->cmap_format = format;
+        }
+    }
+    return best > 0;
+}
+
+// Glyph of a codepoint, 0 (the missing glyph) when the font has none
+static int ttf_glyph_index(const ttf_font_t *f, uint32_t codepoint) {
+    const uint8_t *t = f->data + f->cmap;
+    switch (f->cmap_format) {
+        case 0:
+            return codepoint < 256 ? t[6 + codepoint] : 0;
+        case 6: {
+            uint32_t first = ttf_u16(t + 6), count = ttf_u16(t + 8);
+            return codepoint >= first && codepoint - first < count ? ttf_u16(t + 10 + 2 * (codepoint - first)) : 0;
+        }
+        case 4: {
+            if (codepoint > 0xFFFF)
+                return 0;
+            // First segment ending at or after the codepoint
+            int segments = ttf_u16(t + 6) / 2, lo = 0, hi = segments;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (ttf_u16(t + 14 + 2 * mid) < codepoint)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == segments)
+                return 0;
+            const uint8_t *start = t + 16 + 2 * segments + 2 * lo, *delta = start + 2 * segments, *range = delta + 2 * segments;
+            uint32_t first = ttf_u16(start);
+            if (codepoint < first)
+                return 0;
+            uint16_t glyph = (uint16_t)codepoint;
+            if (ttf_u16(range) && !(glyph = ttf_u16(range + ttf_u16(range) + 2 * (codepoint - first))))
+                return 0;
+            return (uint16_t)(glyph + ttf_u16(delta));
+        }
+        case 12: {
+            uint32_t lo = 0, hi = ttf_u32(t + 12);
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                const uint8_t *group = t + 16 + 12 * (size_t)mid;
+                if (codepoint < ttf_u32(group))
+                    hi = mid;
+                else if (codepoint > ttf_u32(group + 4))
+                    lo = mid + 1;
+                else
+                    return (int)(ttf_u32(group + 8) + codepoint - ttf_u32(group));
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int ttf_advance(const ttf_font_t *f, int glyph) {
+    return ttf_u16(f->data + f->hmtx + 4 * _MIN(glyph, f->hmetrics - 1));
+}
+
+static int ttf_kerning(const ttf_font_t *f, int left, int right) {
+    if (!f->kern)
+        return 0;
+    const uint8_t *t = f->data + f->kern;
+    if (ttf_u16(t) != 0 || !ttf_u16(t + 2) || (ttf_u16(t + 8) & 0xFF07) != 0x0001)
+        return 0;
+    uint32_t key = (uint32_t)left << 16 | (uint32_t)right;
+    int lo = 0, hi = ttf_u16(t + 10);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const uint8_t *pair = t + 18 + 6 * mid;
+        uint32_t at = ttf_u32(pair);
+        if (at == key)
+            return ttf_s16(pair + 4);
+        if (at < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+// Start of a glyph's data, 0 for empty or out of range glyphs
+static uint32_t ttf_glyph_offset(const ttf_font_t *f, int glyph) {
+    if (glyph < 0 || glyph >= f->glyphs)
+        return 0;
+    const uint8_t *loca = f->data + f->loca;
+    uint32_t start, end;
+    if (f->long_loca) {
+        start = ttf_u32(loca + 4 * glyph);
+        end = ttf_u32(loca + 4 * glyph + 4);
     } else {
-        hline(img, y, x, w, color);
-        hline(img, h, x, w, color);
-        vline(img, x, y, h, color);
-        vline(img, w, y, h, color);
+        start = 2u * ttf_u16(loca + 2 * glyph);
+        end = 2u * ttf_u16(loca + 2 * glyph + 2);
     }
+    return end > start ? f->glyf + start : 0;
 }
 
-void simage_draw_triangle(simage_buffer *img, int x0, int y0, int x1, int y1, int x2, int y2, sg_color color, int fill) {
-    if (y0 ==  y1 && y0 ==  y2)
+// Whole pixel box of a glyph at scale with y down, false when it has no outline
+static bool ttf_box(const ttf_font_t *f, int glyph, float scale, int box[4]) {
+    uint32_t offset = ttf_glyph_offset(f, glyph);
+    if (!offset)
+        return false;
+    const uint8_t *g = f->data + offset;
+    box[0] = (int)floorf(ttf_s16(g + 2) * scale);
+    box[1] = (int)floorf(-ttf_s16(g + 8) * scale);
+    box[2] = (int)ceilf(ttf_s16(g + 6) * scale);
+    box[3] = (int)ceilf(-ttf_s16(g + 4) * scale);
+    return box[2] > box[0] && box[3] > box[1];
+}
+
+static void ttf_line(ttf_outline_t *o, float x0, float y0, float x1, float y1) {
+    if (o->count == o->capacity) {
+        size_t capacity = o->capacity ? o->capacity * 2 : 64;
+        ttf_edge_t *edges = realloc(o->edges, capacity * sizeof(ttf_edge_t));
+        if (!edges) {
+            o->failed = true;
+            return;
+        }
+        o->edges = edges;
+        o->capacity = capacity;
+    }
+    o->edges[o->count++] = (ttf_edge_t){x0, y0, x1, y1};
+}
+
+// Quadratic curves are split into segments straying at most a fifth of a pixel from the curve
+static void ttf_curve(ttf_outline_t *o, float x0, float y0, float cx, float cy, float x1, float y1) {
+    float dx = x0 - 2.f * cx + x1, dy = y0 - 2.f * cy + y1;
+    int n = (int)ceilf(sqrtf(sqrtf(dx * dx + dy * dy) / 1.6f));
+    n = _CLAMP(n, 1, 64);
+    float px = x0, py = y0;
+    for (int i = 1; i <= n; i++) {
+        float t = (float)i / n, u = 1.f - t;
+        float x = u * u * x0 + 2.f * u * t * cx + t * t * x1, y = u * u * y0 + 2.f * u * t * cy + t * t * y1;
+        ttf_line(o, px, py, x, y);
+        px = x;
+        py = y;
+    }
+}
+
+static inline void ttf_point(const float m[6], const int *p, float *x, float *y) {
+    *x = m[0] * p[0] + m[2] * p[1] + m[4];
+    *y = m[1] * p[0] + m[3] * p[1] + m[5];
+}
+
+// Appends a glyph's contours through the affine m (font units to bitmap pixels)
+static void ttf_outline(const ttf_font_t *f, ttf_outline_t *o, int glyph, const float m[6], int depth) {
+    uint32_t offset = ttf_glyph_offset(f, glyph);
+    if (!offset || depth > 8)
         return;
-    if (fill) {
+    const uint8_t *g = f->data + offset;
+    int contours = ttf_s16(g);
+    if (contours < 0) {
+        const uint8_t *p = g + 10;
+        for (;;) {
+            int flags = ttf_u16(p), component = ttf_u16(p + 2), dx, dy;
+            p += 4;
+            if (flags & 1) {
+                dx = ttf_s16(p);
+                dy = ttf_s16(p + 2);
+                p += 4;
+            } else {
+                dx = (int8_t)p[0];
+                dy = (int8_t)p[1];
+                p += 2;
+            }
+            // Components placed by matching point numbers are left at the origin
+            float c[6] = {1.f, 0.f, 0.f, 1.f, flags & 2 ? (float)dx : 0.f, flags & 2 ? (float)dy : 0.f};
+            if (flags & 8) {
+                c[0] = c[3] = ttf_s16(p) / 16384.f;
+                p += 2;
+            } else if (flags & 0x40) {
+                c[0] = ttf_s16(p) / 16384.f;
+                c[3] = ttf_s16(p + 2) / 16384.f;
+                p += 4;
+            } else if (flags & 0x80) {
+                for (int i = 0; i < 4; i++)
+                    c[i] = ttf_s16(p + 2 * i) / 16384.f;
+                p += 8;
+            }
+            float t[6] = {
+                m[0] * c[0] + m[2] * c[1], m[1] * c[0] + m[3] * c[1],
+                m[0] * c[2] + m[2] * c[3], m[1] * c[2] + m[3] * c[3],
+                m[0] * c[4] + m[2] * c[5] + m[4], m[1] * c[4] + m[3] * c[5] + m[5]
+            };
+            ttf_outline(f, o, component, t, depth + 1);
+            if (!(flags & 0x20))
+                return;
+        }
+    }
+    const uint8_t *ends = g + 10;
+    int points = contours ? ttf_u16(ends + 2 * (contours - 1)) + 1 : 0;
+    if (!points)
+        return;
+    const uint8_t *p = ends + 2 * contours;
+    p += 2 + ttf_u16(p);
+    int *xy = malloc((size_t)points * (2 * sizeof(int) + 1));
+    if (!xy) {
+        o->failed = true;
+        return;
+    }
+    // Run length coded flags, then the x and y deltas
+    uint8_t *flags = (uint8_t*)(xy + 2 * points);
+    for (int i = 0; i < points;) {
+        uint8_t flag = *p++;
+        int repeat = flag & 8 ? *p++ : 0;
+        for (int r = 0; r <= repeat && i < points; r++)
+            flags[i++] = flag;
+    }
+    for (int axis = 0; axis < 2; axis++) {
+        int v = 0, byte = axis ? 4 : 2, same = axis ? 32 : 16;
+        for (int i = 0; i < points; i++) {
+            if (flags[i] & byte) {
+                v += flags[i] & same ? *p : -*p;
+                p++;
+            } else if (!(flags[i] & same)) {
+                v += ttf_s16(p);
+                p += 2;
+            }
+            xy[2 * i + axis] = v;
+        }
+    }
+    // Consecutive off-curve points imply an on-curve point halfway between them
+    for (int c = 0, s = 0; c < contours; c++) {
+        int e = ttf_u16(ends + 2 * c), first = s, count = e - s;
+        if (e < s || e >= points)
+            break;
+        float sx, sy, x, y, cx = 0.f, cy = 0.f;
+        bool ctrl = false;
+        if (flags[s] & 1) {
+            ttf_point(m, xy + 2 * s, &sx, &sy);
+            first = s + 1;
+        } else if (flags[e] & 1)
+            ttf_point(m, xy + 2 * e, &sx, &sy);
+        else {
+            float ex, ey;
+            ttf_point(m, xy + 2 * s, &sx, &sy);
+            ttf_point(m, xy + 2 * e, &ex, &ey);
+            sx = (sx + ex) * .5f;
+            sy = (sy + ey) * .5f;
+            count = e - s + 1;
+        }
+        x = sx;
+        y = sy;
+        for (int i = first; i < first + count; i++) {
+            float qx, qy;
+            ttf_point(m, xy + 2 * i, &qx, &qy);
+            if (flags[i] & 1) {
+                if (ctrl)
+                    ttf_curve(o, x, y, cx, cy, qx, qy);
+                else
+                    ttf_line(o, x, y, qx, qy);
+                x = qx;
+                y = qy;
+                ctrl = false;
+            } else {
+                if (ctrl) {
+                    float mx = (cx + qx) * .5f, my = (cy + qy) * .5f;
+                    ttf_curve(o, x, y, cx, cy, mx, my);
+                    x = mx;
+                    y = my;
+                }
+                cx = qx;
+                cy = qy;
+                ctrl = true;
+            }
+        }
+        if (ctrl)
+            ttf_curve(o, x, y, cx, cy, sx, sy);
+        else
+            ttf_line(o, x, y, sx, sy);
+        s = e + 1;
+    }
+    free(xy);
+}
+
+/* Exact area coverage: every segment adds the signed area it covers to the cells it crosses,
+   and a running sum along the rows turns that into coverage (nonzero fill for the usual fonts) */
+static bool ttf_coverage(const ttf_outline_t *o, uint8_t *out, int w, int h) {
+    float *acc = calloc((size_t)w * h + 2, sizeof(float));
+    if (!acc)
+        return false;
+    for (size_t i = 0; i < o->count; i++) {
+        const ttf_edge_t *e = &o->edges[i];
+        float x0 = _CLAMP(e->x0, 0.f, (float)w), y0 = _CLAMP(e->y0, 0.f, (float)h);
+        float x1 = _CLAMP(e->x1, 0.f, (float)w), y1 = _CLAMP(e->y1, 0.f, (float)h), dir = 1.f;
+        if (y0 == y1)
+            continue;
         if (y0 > y1) {
-            _SWAP(x0, x1);
-            _SWAP(y0, y1);
+            float tx = x0, ty = y0;
+            x0 = x1;
+            y0 = y1;
+            x1 = tx;
+            y1 = ty;
+            dir = -1.f;
+        }
+        float dxdy = (x1 - x0) / (y1 - y0), x = x0;
+        for (int y = (int)y0, end = _MIN(h, (int)ceilf(y1)); y < end; y++) {
+            float dy = _MIN(y + 1.f, y1) - _MAX((float)y, y0), d = dy * dir;
+            float next = _CLAMP(x + dxdy * dy, 0.f, (float)w), a = _MIN(x, next), b = _MAX(x, next);
+            float *row = acc + (size_t)y * w;
+            int ia = (int)a, ib = (int)ceilf(b);
+            if (ib <= ia + 1) {
+                float mid = .5f * (x + next) - ia;
+                row[ia] += d - d * mid;
+                row[ia + 1] += d * mid;
+            } else {
+                // Area left of the segment: triangles at both ends, a constant slope between
+                float s = 1.f / (b - a), fa = a - ia, fb = b - ib + 1.f;
+                float a0 = .5f * s * (1.f - fa) * (1.f - fa), am = .5f * s * fb * fb;
+                row[ia] += d * a0;
+                if (ib == ia + 2)
+                    row[ia + 1] += d * (1.f - a0 - am);
+                else {
+                    float a1 = s * (1.5f - fa);
+                    row[ia + 1] += d * (a1 - a0);
+                    for (int k = ia + 2; k < ib - 1; k++)
+                        row[k] += d * s;
+                    row[ib - 1] += d * (1.f - a1 - (ib - ia - 3) * s - am);
+                }
+                row[ib] += d * am;
+            }
+            x = next;
+        }
+    }
+    float sum = 0.f;
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        sum += acc[i];
+        out[i] = (uint8_t)(_MIN(fabsf(sum), 1.f) * 255.f + .5f);
+    }
+    free(acc);
+    return true;
+}
+
+// Signed distance to the outline at pixel centers, positive inside, 128 on the edge and 0/255 at spread
+static void ttf_distance(const ttf_outline_t *o, uint8_t *out, int w, int h, float spread) {
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            float px = x + .5f, py = y + .5f, nearest = spread * spread;
+            int winding = 0;
+            for (size_t i = 0; i < o->count; i++) {
+                const ttf_edge_t *e = &o->edges[i];
+                float ex = e->x1 - e->x0, ey = e->y1 - e->y0, qx = px - e->x0, qy = py - e->y0;
+                float length = ex * ex + ey * ey;
+                float t = length > 0.f ? _CLAMP((qx * ex + qy * ey) / length, 0.f, 1.f) : 0.f;
+                float dx = qx - t * ex, dy = qy - t * ey;
+                nearest = _MIN(nearest, dx * dx + dy * dy);
+                // Crossings of a ray towards +x give the nonzero winding
+                if ((e->y0 <= py) != (e->y1 <= py) && e->x0 + (py - e->y0) * ex / ey > px)
+                    winding += ey > 0.f ? 1 : -1;
+            }
+            float distance = winding ? sqrtf(nearest) : -sqrtf(nearest);
+            out[(size_t)y * w + x] = (uint8_t)_CLAMP(128.f + distance * 128.f / spread + .5f, 0.f, 255.f);
+        }
+}
+
+/* Glyphs live in an array with an open addressing index of their codepoints, slots hold the
+   glyph's position + 1 and 0 marks an empty slot. Kerning pairs are kept sorted */
+static inline size_t font_hash(uint32_t codepoint) {
+    uint32_t h = codepoint * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+static simage_glyph* font_find(simage_font *font, uint32_t codepoint) {
+    if (!font->index_capacity)
+        return NULL;
+    size_t mask = font->index_capacity - 1;
+    for (size_t i = font_hash(codepoint) & mask; font->index[i]; i = (i + 1) & mask)
+        if (font->glyphs[font->index[i] - 1].codepoint == codepoint)
+            return &font->glyphs[font->index[i] - 1];
+    return NULL;
+}
+
+static void font_place(simage_font *font, size_t glyph) {
+    size_t mask = font->index_capacity - 1, i = font_hash(font->glyphs[glyph].codepoint) & mask;
+    while (font->index[i])
+        i = (i + 1) & mask;
+    font->index[i] = (uint32_t)glyph + 1;
+}
+
+static simage_glyph* font_insert(simage_font *font, const simage_glyph *glyph) {
+    simage_glyph *found = font_find(font, glyph->codepoint);
+    if (found) {
+        *found = *glyph;
+        return found;
+    }
+    if (font->glyph_count >= UINT32_MAX - 1)
+        return NULL;
+    if (font->glyph_count == font->glyph_capacity) {
+        size_t capacity = font->glyph_capacity ? font->glyph_capacity * 2 : 128;
+        simage_glyph *glyphs = realloc(font->glyphs, capacity * sizeof(simage_glyph));
+        if (!glyphs)
+            return NULL;
+        font->glyphs = glyphs;
+        font->glyph_capacity = capacity;
+    }
+    // The index is kept at most half full
+    if ((font->glyph_count + 1) * 2 > font->index_capacity) {
+        size_t capacity = font->index_capacity ? font->index_capacity * 2 : 256;
+        uint32_t *index = calloc(capacity, sizeof(uint32_t));
+        if (!index)
+            return NULL;
+        free(font->index);
+        font->index = index;
+        font->index_capacity = capacity;
+        for (size_t i = 0; i < font->glyph_count; i++)
+            font_place(font, i);
+    }
+    font->glyphs[font->glyph_count] = *glyph;
+    font_place(font, font->glyph_count);
+    return &font->glyphs[font->glyph_count++];
+}
+
+bool simage_font_add_kerning(simage_font *font, uint32_t first, uint32_t second, float amount) {
+    uint64_t key = (uint64_t)first << 32 | second;
+    size_t lo = 0, hi = font->kerning_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (((uint64_t)font->kerning[mid].first << 32 | font->kerning[mid].second) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < font->kerning_count && font->kerning[lo].first == first && font->kerning[lo].second == second) {
+        font->kerning[lo].amount = amount;
+        return true;
+    }
+    if (font->kerning_count == font->kerning_capacity) {
+        size_t capacity = font->kerning_capacity ? font->kerning_capacity * 2 : 64;
+        simage_kerning *kerning = realloc(font->kerning, capacity * sizeof(simage_kerning));
+        if (!kerning)
+            return false;
+        font->kerning = kerning;
+        font->kerning_capacity = capacity;
+    }
+    memmove(font->kerning + lo + 1, font->kerning + lo, (font->kerning_count - lo) * sizeof(simage_kerning));
+    font->kerning[lo] = (simage_kerning){first, second, amount};
+    font->kerning_count++;
+    return true;
+}
+
+static float font_kerning(simage_font *font, uint32_t first, uint32_t second) {
+    uint64_t key = (uint64_t)first << 32 | second;
+    size_t lo = 0, hi = font->kerning_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        uint64_t at = (uint64_t)font->kerning[mid].first << 32 | font->kerning[mid].second;
+        if (at == key)
+            return font->kerning[mid].amount;
+        if (at < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (font->ttf) {
+        const ttf_font_t *ttf = font->ttf;
+        return ttf_kerning(ttf, ttf_glyph_index(ttf, first), ttf_glyph_index(ttf, second)) * font->ttf_scale;
+    }
+    return 0.f;
+}
+
+bool simage_font_load_grid(const char *path, int cell_w, int cell_h, uint32_t first, float sdf_spread, simage_font *dst) {
+    memset(dst, 0, sizeof(simage_font));
+    if (cell_w <= 0 || cell_h <= 0 || !simage_load_from_path(path, &dst->atlas))
+        return false;
+    dst->ascent = dst->line_height = (float)cell_h;
+    dst->sdf_spread = _MAX(sdf_spread, 0.f);
+    int columns = dst->atlas.width / cell_w, rows = dst->atlas.height / cell_h;
+    for (int i = 0; i < columns * rows; i++) {
+        simage_glyph glyph = {
+            .codepoint = first + i,
+            .x = i % columns * cell_w, .y = i / columns * cell_h,
+            .w = cell_w, .h = cell_h,
+            .xoff = 0, .yoff = -cell_h,
+            .advance = (float)cell_w
+        };
+        if (!font_insert(dst, &glyph)) {
+            simage_font_destroy(dst);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool simage_font_from_atlas(simage_buffer *atlas, const simage_glyph *glyphs, size_t n, float ascent, float line_height, float sdf_spread, simage_font *dst) {
+    memset(dst, 0, sizeof(simage_font));
+    if (!simage_dupe(atlas, &dst->atlas))
+        return false;
+    dst->ascent = ascent;
+    dst->line_height = line_height;
+    dst->sdf_spread = _MAX(sdf_spread, 0.f);
+    for (size_t i = 0; i < n; i++) {
+        // Rectangles reaching outside the atlas are cut to it
+        simage_glyph glyph = glyphs[i];
+        glyph.x = _CLAMP(glyph.x, 0, (int)atlas->width);
+        glyph.y = _CLAMP(glyph.y, 0, (int)atlas->height);
+        glyph.w = _CLAMP(glyph.w, 0, (int)atlas->width - glyph.x);
+        glyph.h = _CLAMP(glyph.h, 0, (int)atlas->height - glyph.y);
+        if (!font_insert(dst, &glyph)) {
+            simage_font_destroy(dst);
+            return false;
         }
-        if (y0 > y2) {
-            _SWAP(x0, x2);
-            _SWAP(y0, y2);
+    }
+    return true;
+}
+
+// Shelf packing of baked glyphs, the atlas doubles in height when full
+static bool font_pack(simage_font *font, int w, int h, int *x, int *y) {
+    simage_buffer *atlas = &font->atlas;
+    if (w > (int)atlas->width)
+        return false;
+    if (font->pack_x + w > (int)atlas->width) {
+        font->pack_x = 0;
+        font->pack_y += font->pack_h;
+        font->pack_h = 0;
+    }
+    if (font->pack_y + h > (int)atlas->height) {
+        size_t height = atlas->height;
+        while ((size_t)font->pack_y + h > height)
+            height *= 2;
+        int32_t *grown = realloc(atlas->buffer, atlas->width * height * sizeof(int32_t));
+        if (!grown)
+            return false;
+        memset(grown + (size_t)atlas->width * atlas->height, 0, atlas->width * (height - atlas->height) * sizeof(int32_t));
+        atlas->buffer = grown;
+        atlas->height = (unsigned int)height;
+    }
+    *x = font->pack_x;
+    *y = font->pack_y;
+    font->pack_x += w;
+    font->pack_h = _MAX(font->pack_h, h);
+    return true;
+}
+
+static simage_glyph* font_bake(simage_font *font, uint32_t codepoint) {
+    const ttf_font_t *ttf = font->ttf;
+    int index = ttf_glyph_index(ttf, codepoint), box[4];
+    simage_glyph glyph = {
+        .codepoint = codepoint,
+        .advance = ttf_advance(ttf, index) * font->ttf_scale
+    };
+    // Empty glyphs such as spaces have no box. A glyph failing to bake is cached empty with its
+    // advance, rather than retried on every use
+    if (!ttf_box(ttf, index, font->ttf_scale, box))
+        return font_insert(font, &glyph);
+    int pad = (int)ceilf(font->sdf_spread);
+    glyph.xoff = box[0] - pad;
+    glyph.yoff = box[1] - pad;
+    int w = box[2] - box[0] + 2 * pad, h = box[3] - box[1] + 2 * pad;
+    float m[6] = {font->ttf_scale, 0.f, 0.f, -font->ttf_scale, (float)-glyph.xoff, (float)-glyph.yoff};
+    ttf_outline_t outline = {0};
+    ttf_outline(ttf, &outline, index, m, 0);
+    uint8_t *coverage = malloc((size_t)w * h);
+    if (coverage && !outline.failed) {
+        bool baked = true;
+        if (font->sdf_spread > 0.f)
+            ttf_distance(&outline, coverage, w, h, font->sdf_spread);
+        else
+            baked = ttf_coverage(&outline, coverage, w, h);
+        if (baked && font_pack(font, w, h, &glyph.x, &glyph.y)) {
+            for (int j = 0; j < h; j++) {
+                uint32_t *row = simage_row_ptr(&font->atlas, glyph.y + j) + glyph.x;
+                for (int i = 0; i < w; i++)
+                    row[i] = _RGBA(255, 255, 255, coverage[(size_t)j * w + i]);
+            }
+            glyph.w = w;
+            glyph.h = h;
         }
-        if (y1 > y2) {
-            _SWAP(x1, x2);
-            _SWAP(y1, y2);
+    }
+    free(coverage);
+    free(outline.edges);
+    return font_insert(font, &glyph);
+}
+
+bool simage_font_from_ttf(const void *data, float pixel_height, float sdf_spread, simage_font *dst) {
+    memset(dst, 0, sizeof(simage_font));
+    ttf_font_t *ttf = malloc(sizeof(ttf_font_t));
+    if (!ttf || !data || !(pixel_height > 0.f) || !ttf_init(ttf, (const uint8_t*)data)) {
+        free(ttf);
+        return false;
+    }
+    dst->ttf = ttf;
+    dst->ttf_scale = pixel_height / (ttf->ascent - ttf->descent);
+    dst->ascent = ttf->ascent * dst->ttf_scale;
+    dst->line_height = (ttf->ascent - ttf->descent + ttf->gap) * dst->ttf_scale;
+    dst->sdf_spread = _MAX(sdf_spread, 0.f);
+    // Wide enough for a few of the largest glyphs per shelf
+    unsigned int width = 256;
+    while (width < 4 * (pixel_height + 2 * dst->sdf_spread) && width < 8192)
+        width *= 2;
+    if (!alloc_buffer(width, 64, &dst->atlas)) {
+        simage_font_destroy(dst);
+        return false;
+    }
+    memset(dst->atlas.buffer, 0, (size_t)width * 64 * sizeof(int32_t));
+    return true;
+}
+
+void simage_font_destroy(simage_font *font) {
+    free(font->atlas.buffer);
+    free(font->glyphs);
+    free(font->index);
+    free(font->kerning);
+    free(font->ttf);
+    memset(font, 0, sizeof(simage_font));
+}
+
+// Decodes and advances past one codepoint, malformed sequences give U+FFFD and skip a byte
+static uint32_t utf8_next(const char **text) {
+    const unsigned char *p = (const unsigned char*)*text;
+    uint32_t c = p[0];
+    int n = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : -1;
+    if (n < 0) {
+        *text += 1;
+        return 0xFFFD;
+    }
+    c &= 0x7F >> n;
+    for (int i = 1; i <= n; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *text += 1;
+            return 0xFFFD;
         }
+        c = c << 6 | (p[i] & 0x3F);
+    }
+    static const uint32_t least[4] = {0, 0x80, 0x800, 0x10000};
+    *text += n + 1;
+    return c < least[n] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF) ? 0xFFFD : c;
+}
+
+// Cached glyph, baking it first for TrueType fonts. Bitmap fonts fall back to U+FFFD or '?'
+static simage_glyph* font_glyph(simage_font *font, uint32_t codepoint) {
+    simage_glyph *glyph = font_find(font, codepoint);
+    if (glyph)
+        return glyph;
+    if (font->ttf)
+        return font_bake(font, codepoint);
+    if (!(glyph = font_find(font, 0xFFFD)))
+        glyph = font_find(font, '?');
+    return glyph;
+}
+
+// Atlas alpha to coverage, distance fields are mapped to a one destination pixel wide edge
+static void text_coverage(const simage_font *font, float scale, uint8_t lut[256]) {
+    for (int a = 0; a < 256; a++) {
+        if (font->sdf_spread > 0.f) {
+            float distance = (a - 128) / 128.f * font->sdf_spread * scale;
+            lut[a] = (uint8_t)(_CLAMP(distance + .5f, 0.f, 1.f) * 255.f + .5f);
+        } else
+            lut[a] = (uint8_t)a;
+    }
+}
 
-        int total_height = y2 - y0, i, j;
-        for (i = 0; i < total_height; ++i) {
-            int second_half = i > y1 - y0 || y1 == y0;
-            int segment_height = second_half ? y2 - y1 : y1 - y0;
-            float alpha = (float)i / total_height;
-            float beta  = (float)(i - (second_half ? y1 - y0 : 0)) / segment_height;
-            int ax = x0 + (x2 - x0) * alpha;
-            int ay = y0 + (y2 - y0) * alpha;
-            int bx = second_half ? x1 + (x2 - x1) : x0 + (x1 - x0) * beta;
-            int by = second_half ? y1 + (y2 - y1) : y0 + (y1 - y0) * beta;
-            if (ax > bx) {
-                _SWAP(ax, bx);
-                _SWAP(ay, by);
+// Alpha of atlas pixel x/y of a glyph, 0 outside its rectangle
+static inline uint32_t glyph_alpha(const simage_font *font, const simage_glyph *g, int x, int y) {
+    if (x < 0 || y < 0 || x >= g->w || y >= g->h)
+        return 0;
+    return (uint32_t)simage_row_ptr((simage_buffer*)&font->atlas, g->y + y)[g->x + x] & 0xFF;
+}
+
+/* gx/gy is where the top-left atlas pixel's center lands. Rows are turned into source pixels of
+   the text color with the glyph coverage as alpha and blended in chunks */
+static void draw_glyph(simage_buffer *img, const simage_font *font, const simage_glyph *g, float gx, float gy, float scale, uint32_t color, const uint8_t *lut) {
+    uint32_t src[64], rgb = color & 0xFFFFFF00, alpha = color & 0xFF;
+    if (scale == 1.f) {
+        int x = (int)floorf(gx + .5f), y = (int)floorf(gy + .5f);
+        int i0 = _MAX(-x, 0), j0 = _MAX(-y, 0);
+        int i1 = (int)_MIN((int64_t)g->w, (int64_t)img->width - x), j1 = (int)_MIN((int64_t)g->h, (int64_t)img->height - y);
+        for (int j = j0; j < j1; j++) {
+            const uint32_t *from = simage_row_ptr((simage_buffer*)&font->atlas, g->y + j) + g->x;
+            uint32_t *row = simage_row_ptr(img, y + j) + x;
+            for (int i = i0; i < i1; i += 64) {
+                int n = _MIN(i1 - i, 64);
+                for (int k = 0; k < n; k++)
+                    src[k] = rgb | div255(alpha * lut[from[i + k] & 0xFF]);
+                blend_row(row + i, src, n, SIMAGE_BLEND_ALPHA);
             }
-            for (j = ax; j <= bx; ++j)
-                simage_pset(img, j, y0 + i, color);
         }
-    } else {
-        simage_draw_line(img, x0, y0, x1, y1, color);
-        simage_draw_line(img, x1, y1, x2, y2, color);
-        simage_draw_line(img, x2, y2, x0, y0, color);
+        return;
+    }
+    // Bilinear taps reach one atlas pixel around the rectangle
+    float inv = 1.f / scale;
+    int x0 = (int)_MAX(floorf(gx - scale), 0.f), y0 = (int)_MAX(floorf(gy - scale), 0.f);
+    int x1 = (int)_MIN(ceilf(gx + g->w * scale) + 1.f, (float)img->width), y1 = (int)_MIN(ceilf(gy + g->h * scale) + 1.f, (float)img->height);
+    for (int y = y0; y < y1; y++) {
+        // 8 bits of fraction
+        int sy = (int)floorf((y - gy) * inv * 256.f), ty = sy >> 8, fy = sy & 255;
+        uint32_t *row = simage_row_ptr(img, y);
+        for (int x = x0; x < x1; x += 64) {
+            int n = _MIN(x1 - x, 64);
+            for (int k = 0; k < n; k++) {
+                int sx = (int)floorf((x + k - gx) * inv * 256.f), tx = sx >> 8, fx = sx & 255;
+                uint32_t top = glyph_alpha(font, g, tx, ty) * (256 - fx) + glyph_alpha(font, g, tx + 1, ty) * fx;
+                uint32_t bottom = glyph_alpha(font, g, tx, ty + 1) * (256 - fx) + glyph_alpha(font, g, tx + 1, ty + 1) * fx;
+                src[k] = rgb | div255(alpha * lut[(top * (256 - fy) + bottom * fy + (1 << 15)) >> 16]);
+            }
+            blend_row(row + x, src, n, SIMAGE_BLEND_ALPHA);
+        }
+    }
+}
+
+void simage_draw_text(simage_buffer *img, simage_font *font, float x, float y, const char *text, float scale, sg_color color) {
+    if (!img->buffer || !text || !(scale > 0.f) || !isfinite(x) || !isfinite(y))
+        return;
+    uint8_t lut[256];
+    text_coverage(font, scale, lut);
+    uint32_t c = sg_color_to_int(color), previous = 0;
+    float pen = x, baseline = y + font->ascent * scale;
+    while (*text) {
+        uint32_t codepoint = utf8_next(&text);
+        if (codepoint == '\n') {
+            pen = x;
+            baseline += font->line_height * scale;
+            previous = 0;
+            continue;
+        }
+        const simage_glyph *g = font_glyph(font, codepoint);
+        if (!g)
+            continue;
+        if (previous)
+            pen += font_kerning(font, previous, codepoint) * scale;
+        // Glyphs entirely off the image are only advanced over
+        float gx = pen + g->xoff * scale, gy = baseline + g->yoff * scale;
+        if (g->w && g->h && gx < img->width && gy < img->height && gx + g->w * scale > -1.f && gy + g->h * scale > -1.f)
+            draw_glyph(img, font, g, gx, gy, scale, c, lut);
+        pen += g->advance * scale;
+        previous = codepoint;
+    }
+}
+
+void simage_measure_text(simage_font *font, const char *text, float scale, float *w, float *h) {
+    float pen = 0.f, width = 0.f;
+    int lines = 1;
+    uint32_t previous = 0;
+    while (text && *text) {
+        uint32_t codepoint = utf8_next(&text);
+        if (codepoint == '\n') {
+            width = fmaxf(width, pen);
+            pen = 0.f;
+            lines++;
+            previous = 0;
+            continue;
+        }
+        const simage_glyph *g = font_glyph(font, codepoint);
+        if (!g)
+            continue;
+        if (previous)
+            pen += font_kerning(font, previous, codepoint) * scale;
+        pen += g->advance * scale;
+        previous = codepoint;
     }
+    if (w)
+        *w = fmaxf(width, pen);
+    if (h)
+        *h = lines * font->line_height * scale;
 }
 
 void simage_brightness(simage_buffer *img, float value) {
@@ -10973,13 +16288,39 @@ sg_image sg_load_texture_from_memory(unsigned char *data, size_t data_size, unsi
     return image_to_sg(&tmp);
 }
 
+sg_image sg_load_texture_from_buffer(simage_buffer *img) {
+    return image_to_sg(img);
+}
+
+sg_image sg_load_texture_from_buffer_mipmapped(simage_buffer *img, simage_filter filter, bool gamma_correct) {
+    simage_buffer levels[SG_MAX_MIPMAPS];
+    int count = simage_build_mips(img, filter, gamma_correct, levels);
+    if (!count)
+        return (sg_image){.id=SG_INVALID_ID};
+    sg_image_desc desc = {
+        .width = img->width,
+        .height = img->height,
+        .num_mipmaps = count,
+        .pixel_format = SG_PIXELFORMAT_RGBA8
+    };
+    for (int i = 0; i < count; i++)
+        desc.data.subimage[0][i] = (sg_range) {
+            .ptr = levels[i].buffer,
+            .size = (size_t)levels[i].width * levels[i].height * sizeof(int)
+        };
+    sg_image texture = sg_make_image(&desc);
+    for (int i = 0; i < count; i++)
+        simage_destroy_buffer(&levels[i]);
+    return texture;
+}
+
 void sg_update_texture_from_buffer(sg_image texture, simage_buffer *img) {
     if (texture.id == SG_INVALID_ID)
         return;
     sg_update_image(texture, &(sg_image_data) {
         .subimage[0][0] = (sg_range) {
             .ptr = img->buffer,
-            .size = img->width * img->height * sizeof(int)
+            .size = (size_t)img->width * img->height * sizeof(int)
         }
     });
 }
@@ -0,0 +1,427 @@
+/* Built twice, once with SIMAGE_NO_SIMD. Operations with SIMD paths are run on fixed pseudo random
+   inputs and reduced to digests, `--write file` stores them and `--compare file` checks the SIMD
+   build against the scalar one. Labeling and flood fills are checked against fixed expectations */
+#define SOKOL_IMAGE_IMPL
+#include "sokol_image.h"
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(COND)                                                         \
+    do {                                                                    \
+        if (!(COND)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static uint32_t rng = 0x2545F491;
+
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void random_image(unsigned int w, unsigned int h, simage_buffer *dst) {
+    simage_empty(w, h, sg_black, dst);
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        uint32_t c = next_random();
+        // Mix of opaque, transparent and translucent pixels
+        switch (c & 3) {
+            case 0: c |= 0xFF; break;
+            case 1: c &= ~0xFFu; break;
+        }
+        dst->buffer[i] = (int32_t)c;
+    }
+}
+
+/* Digests */
+
+typedef struct digest {
+    char name[32];
+    uint64_t hash;
+    bool exact;
+} digest_t;
+
+// The NEON shading divides with a refined reciprocal estimate, which may round differently
+#if defined(SIMAGE_NEON)
+#define SHADING_EXACT false
+#else
+#define SHADING_EXACT true
+#endif
+
+static digest_t digests[256];
+static int digest_count = 0;
+
+static void add_digest(const char *name, simage_buffer *img) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *p = (const unsigned char*)img->buffer;
+    for (size_t i = 0; img->buffer && i < (size_t)img->width * img->height * 4; i++)
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    hash = (hash ^ img->width) * 1099511628211ull;
+    hash = (hash ^ img->height) * 1099511628211ull;
+    digest_t *d = &digests[digest_count++];
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->hash = hash;
+    d->exact = true;
+}
+
+static void digest_fills(void) {
+    simage_buffer img;
+    simage_empty(257, 131, sg_black, &img);
+    for (int i = 0; i < 64; i++) {
+        sg_color c = simage_unpack_color(next_random());
+        simage_fill_rect(&img, (int)(next_random() % 300) - 20, (int)(next_random() % 150) - 10,
+                         (int)(next_random() % 200), (int)(next_random() % 100), c);
+    }
+    add_digest("fill_rect", &img);
+    simage_destroy_buffer(&img);
+    // Large enough for the streaming stores
+    simage_empty(1031, 1029, sg_black, &img);
+    simage_fill(&img, simage_unpack_color(0x12345678));
+    add_digest("fill_large", &img);
+    simage_destroy_buffer(&img);
+}
+
+static void digest_blends(void) {
+    static const char *names[] = {"none", "alpha", "premultiplied", "add", "multiply", "screen"};
+    const simage_blend_mode modes[] = {SIMAGE_BLEND_NONE, SIMAGE_BLEND_ALPHA, SIMAGE_BLEND_PREMULTIPLIED,
+                                       SIMAGE_BLEND_ADD, SIMAGE_BLEND_MULTIPLY, SIMAGE_BLEND_SCREEN};
+    for (int gamma = 0; gamma < 2; gamma++) {
+        simage_set_gamma_correct(gamma);
+        for (int m = 0; m < 6; m++) {
+            simage_buffer dst, src;
+            char name[32];
+            random_image(67, 45, &dst);
+            random_image(61, 39, &src);
+            simage_blend(&dst, &src, 3, 1, modes[m]);
+            simage_clipped_blend(&dst, &src, -5, 20, 7, 3, 40, 30, modes[m]);
+            snprintf(name, sizeof(name), "blend_%s%s", names[m], gamma ? "_gamma" : "");
+            add_digest(name, &dst);
+            simage_destroy_buffer(&dst);
+            simage_destroy_buffer(&src);
+        }
+    }
+    simage_set_gamma_correct(false);
+
+    simage_buffer dst, src;
+    simage_sprite sprite;
+    random_image(90, 70, &dst);
+    random_image(45, 33, &src);
+    simage_compile_sprite(&src, &sprite);
+    simage_blit_sprite(&dst, &sprite, 11, -4);
+    add_digest("sprite", &dst);
+    simage_destroy_sprite(&sprite);
+    simage_destroy_buffer(&dst);
+    simage_destroy_buffer(&src);
+}
+
+static void digest_resizes(void) {
+    static const char *names[] = {"nearest", "bilinear", "bicubic", "mitchell", "lanczos3", "box", "kaiser", "area"};
+    simage_buffer src, dst;
+    random_image(256, 192, &src);
+    for (int shift = 1; shift <= 3; shift++) {
+        char name[32];
+        simage_resized(&src, 256 >> shift, 192 >> shift, &dst);
+        snprintf(name, sizeof(name), "reduce_%dx", 1 << shift);
+        add_digest(name, &dst);
+        simage_destroy_buffer(&dst);
+    }
+    for (int f = SIMAGE_FILTER_NEAREST; f <= SIMAGE_FILTER_AREA; f++) {
+        char name[32];
+        simage_resized_ex(&src, 301, 77, (simage_filter)f, &dst);
+        snprintf(name, sizeof(name), "resize_%s_a", names[f]);
+        add_digest(name, &dst);
+        simage_destroy_buffer(&dst);
+        simage_resized_ex(&src, 61, 250, (simage_filter)f, &dst);
+        snprintf(name, sizeof(name), "resize_%s_b", names[f]);
+        add_digest(name, &dst);
+        simage_destroy_buffer(&dst);
+    }
+    simage_buffer mips[SG_MAX_MIPMAPS];
+    int levels = simage_build_mips(&src, SIMAGE_FILTER_BOX, false, mips);
+    for (int i = 0; i < levels; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "mip_%d", i);
+        add_digest(name, &mips[i]);
+        if (mips[i].buffer != src.buffer)
+            simage_destroy_buffer(&mips[i]);
+    }
+    simage_destroy_buffer(&src);
+}
+
+static void digest_transforms(void) {
+    simage_buffer src, dst;
+    random_image(37, 29, &src);
+    simage_rotated90(&src, &dst);
+    add_digest("rotated90", &dst);
+    simage_destroy_buffer(&dst);
+    simage_rotated180(&src, &dst);
+    add_digest("rotated180", &dst);
+    simage_destroy_buffer(&dst);
+    simage_rotated270(&src, &dst);
+    add_digest("rotated270", &dst);
+    simage_destroy_buffer(&dst);
+    simage_flip_h(&src);
+    add_digest("flip_h", &src);
+    simage_flip_v(&src);
+    add_digest("flip_v", &src);
+    simage_destroy_buffer(&src);
+
+    random_image(83, 61, &src);
+    for (int f = SIMAGE_FILTER_NEAREST; f <= SIMAGE_FILTER_BICUBIC; f++) {
+        char name[32];
+        simage_rotated_ex(&src, 31.f, (simage_filter)f, &dst);
+        snprintf(name, sizeof(name), "rotated_%d", f);
+        add_digest(name, &dst);
+        simage_destroy_buffer(&dst);
+    }
+    simage_rotated_shear(&src, 31.f, &dst);
+    add_digest("rotated_shear", &dst);
+    simage_destroy_buffer(&dst);
+    const float affine[6] = {1.3f, .4f, -7.f, -.2f, .9f, 11.f};
+    const float perspective[9] = {1.1f, .2f, 3.f, .1f, .9f, -2.f, .002f, .001f, 1.f};
+    for (int e = SIMAGE_EDGE_NONE; e <= SIMAGE_EDGE_WRAP; e++)
+        for (int f = SIMAGE_FILTER_NEAREST; f <= SIMAGE_FILTER_BICUBIC; f++) {
+            char name[32];
+            simage_warp_affine(&src, affine, 120, 90, (simage_filter)f, (simage_edge_mode)e, &dst);
+            snprintf(name, sizeof(name), "warp_affine_%d_%d", e, f);
+            add_digest(name, &dst);
+            simage_destroy_buffer(&dst);
+            simage_warp_perspective(&src, perspective, 120, 90, (simage_filter)f, (simage_edge_mode)e, &dst);
+            snprintf(name, sizeof(name), "warp_perspective_%d_%d", e, f);
+            add_digest(name, &dst);
+            simage_destroy_buffer(&dst);
+        }
+    simage_destroy_buffer(&src);
+}
+
+static void digest_triangles(void) {
+    simage_buffer img, texture;
+    simage_empty(200, 150, sg_black, &img);
+    for (int i = 0; i < 400; i++) {
+        // Mostly single block triangles, some spanning the image
+        int size = i % 8 ? 9 : 300, x = (int)(next_random() % 220) - 10, y = (int)(next_random() % 170) - 10;
+        simage_draw_triangle(&img, x, y, x + (int)(next_random() % size) - size / 2, y + (int)(next_random() % size) - size / 2,
+                             x + (int)(next_random() % size) - size / 2, y + (int)(next_random() % size) - size / 2,
+                             simage_unpack_color(next_random() | 0xFF), 1);
+    }
+    add_digest("triangles", &img);
+
+    random_image(16, 16, &texture);
+    for (int bits = 16; bits <= 32; bits += 16) {
+        simage_depth depth;
+        char name[32];
+        simage_fill(&img, sg_black);
+        simage_depth_empty(img.width, img.height, bits, &depth);
+        for (int i = 0; i < 60; i++) {
+            simage_vertex v[3];
+            for (int k = 0; k < 3; k++)
+                v[k] = (simage_vertex){
+                    .x = (float)(next_random() % 2400) / 10.f - 20.f, .y = (float)(next_random() % 1800) / 10.f - 15.f,
+                    .z = (float)(next_random() % 1000) / 1000.f, .w = 1.f + (float)(next_random() % 100) / 50.f,
+                    .u = (float)(next_random() % 300) / 100.f - 1.f, .v = (float)(next_random() % 300) / 100.f - 1.f,
+                    .color = simage_unpack_color(next_random() | 0x80)
+                };
+            if (i % 3 == 0)
+                simage_draw_triangle_shaded(&img, &depth, v);
+            else
+                simage_draw_triangle_textured(&img, &depth, v, &texture, i % 3 == 1 ? SIMAGE_FILTER_NEAREST : SIMAGE_FILTER_BILINEAR,
+                                              (i / 3) % 2 ? SIMAGE_EDGE_WRAP : SIMAGE_EDGE_CLAMP);
+        }
+        snprintf(name, sizeof(name), "triangles_3d_%d", bits);
+        add_digest(name, &img);
+        digests[digest_count - 1].exact = SHADING_EXACT;
+        simage_depth_destroy(&depth);
+    }
+    simage_destroy_buffer(&texture);
+    simage_destroy_buffer(&img);
+}
+
+static bool write_digests(const char *path) {
+    FILE *fh = fopen(path, "w");
+    if (!fh)
+        return false;
+    for (int i = 0; i < digest_count; i++)
+        fprintf(fh, "%s %016llx\n", digests[i].name, (unsigned long long)digests[i].hash);
+    fclose(fh);
+    return true;
+}
+
+static bool compare_digests(const char *path) {
+    FILE *fh = fopen(path, "r");
+    if (!fh)
+        return false;
+    digest_t scalar[256];
+    unsigned long long hash;
+    int count = 0;
+    while (count < 256 && fscanf(fh, "%31s %llx", scalar[count].name, &hash) == 2)
+        scalar[count++].hash = hash;
+    fclose(fh);
+    for (int i = 0; i < digest_count; i++) {
+        int j = 0;
+        while (j < count && strcmp(scalar[j].name, digests[i].name))
+            j++;
+        if (j == count) {
+            fprintf(stderr, "%s missing from %s\n", digests[i].name, path);
+            failures++;
+        } else if (digests[i].exact && digests[i].hash != scalar[j].hash) {
+            fprintf(stderr, "%s differs from the scalar build\n", digests[i].name);
+            failures++;
+        }
+    }
+    return true;
+}
+
+/* Labeling and flood fills */
+
+// One character per pixel, each distinct character a color
+static void pattern_image(const char *rows[], int h, simage_buffer *dst) {
+    int w = (int)strlen(rows[0]);
+    simage_empty(w, h, sg_black, dst);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            dst->buffer[y * w + x] = rows[y][x] == '.' ? 0x000000FF : (int32_t)((uint32_t)(unsigned char)rows[y][x] << 24 | 0xFF);
+}
+
+static bool not_background(uint32_t color, void *userdata) {
+    (void)userdata;
+    return color != 0x000000FF;
+}
+
+static void test_labels(void) {
+    const char *rows[] = {
+        "aa..b...",
+        "a...b..c",
+        "..d.bb.c",
+        ".d......",
+        "d..eeee.",
+        "...e..e."
+    };
+    simage_buffer img;
+    uint32_t labels[48];
+    simage_component *stats;
+    pattern_image(rows, 6, &img);
+    simage_label_desc desc = {.predicate = not_background};
+
+    // 4-connected: a, b, c, three separate d pixels and e
+    CHECK(simage_label_components(&img, &desc, labels, &stats) == 7);
+    CHECK(labels[0] == 1 && labels[1] == 1 && labels[8] == 1 && labels[2] == 0);
+    CHECK(stats[0].x == 0 && stats[0].y == 0 && stats[0].w == 2 && stats[0].h == 2 && stats[0].area == 3);
+    CHECK(stats[1].x == 4 && stats[1].y == 0 && stats[1].w == 2 && stats[1].h == 3 && stats[1].area == 4);
+    CHECK(fabsf(stats[1].cx - 4.25f) < 1e-5f && fabsf(stats[1].cy - 1.25f) < 1e-5f);
+    CHECK(stats[2].x == 7 && stats[2].y == 1 && stats[2].area == 2);
+    CHECK(labels[2 * 8 + 2] != labels[3 * 8 + 1] && labels[3 * 8 + 1] != labels[4 * 8]);
+    CHECK(stats[6].x == 3 && stats[6].y == 4 && stats[6].w == 4 && stats[6].h == 2 && stats[6].area == 6);
+    CHECK(fabsf(stats[6].cx - 4.5f) < 1e-5f && fabsf(stats[6].cy - 26.f / 6.f) < 1e-5f);
+    free(stats);
+
+    // 8-connected joins the d diagonal
+    desc.eight_connected = true;
+    CHECK(simage_label_components(&img, &desc, labels, &stats) == 5);
+    CHECK(labels[2 * 8 + 2] == labels[3 * 8 + 1] && labels[3 * 8 + 1] == labels[4 * 8]);
+    CHECK(stats[3].x == 0 && stats[3].y == 2 && stats[3].w == 3 && stats[3].h == 3 && stats[3].area == 3);
+    free(stats);
+
+    // Without a predicate the background splits into two components of its own
+    CHECK(simage_label_components(&img, NULL, labels, NULL) == 9);
+    // A slightly different corner cuts a apart, unless the tolerance covers it
+    img.buffer[0] = 'a' << 24 | 0x01FF;
+    CHECK(simage_label_components(&img, NULL, labels, NULL) == 11);
+    desc = (simage_label_desc){.tolerance = 1};
+    CHECK(simage_label_components(&img, &desc, labels, NULL) == 9);
+    CHECK(labels[0] == labels[1] && labels[1] == labels[8]);
+    simage_destroy_buffer(&img);
+}
+
+// Strips labeled on separate threads have to agree with one flood per component
+static void test_label_strips(void) {
+    enum { W = 640, H = 480 };
+    simage_buffer img;
+    simage_empty(W, H, sg_black, &img);
+    for (int i = 0; i < W * H; i++)
+        img.buffer[i] = next_random() % 5 ? 0x000000FF : 0x0000FFFF;
+    uint32_t *labels = malloc(W * H * sizeof(uint32_t));
+    unsigned char *mask = calloc(W * H, 1);
+    simage_component *stats;
+    simage_set_thread_count(4);
+    int n = simage_label_components(&img, &(simage_label_desc){.eight_connected = true}, labels, &stats);
+    simage_set_thread_count(0);
+    CHECK(n > 1);
+    size_t total = 0;
+    for (int l = 1; l <= n; l += 37) {
+        const simage_component *c = &stats[l - 1];
+        int i = 0;
+        while (labels[i] != (uint32_t)l)
+            i++;
+        memset(mask, 0, W * H);
+        simage_flood_ex(&img, i % W, i / W, sg_black, &(simage_flood_desc){.eight_connected = true, .mask = mask});
+        size_t area = 0, mismatches = 0;
+        for (int j = 0; j < W * H; j++) {
+            area += mask[j] != 0;
+            mismatches += (mask[j] != 0) != (labels[j] == (uint32_t)l);
+        }
+        CHECK(mismatches == 0 && area == c->area);
+    }
+    for (int l = 0; l < n; l++)
+        total += stats[l].area;
+    CHECK(total == W * H);
+    free(stats);
+    free(mask);
+    free(labels);
+    simage_destroy_buffer(&img);
+}
+
+static void test_flood_masks(void) {
+    const char *rows[] = {
+        "a.aa.",
+        "a.a.a",
+        "aa.a.",
+        ".a.aa"
+    };
+    const char *four = "1....1....11....1...";
+    const char *eight = "1.11.1.1.111.1..1.11";
+    simage_buffer img;
+    unsigned char mask[20];
+    pattern_image(rows, 4, &img);
+
+    memset(mask, 0, sizeof(mask));
+    CHECK(simage_flood_ex(&img, 0, 0, sg_black, &(simage_flood_desc){.mask = mask}));
+    for (int i = 0; i < 20; i++)
+        CHECK((mask[i] == 255) == (four[i] == '1'));
+    memset(mask, 0, sizeof(mask));
+    CHECK(simage_flood_ex(&img, 0, 0, sg_black, &(simage_flood_desc){.eight_connected = true, .mask = mask}));
+    for (int i = 0; i < 20; i++)
+        CHECK((mask[i] == 255) == (eight[i] == '1'));
+
+    // A clip rectangle stops the fill, the image is untouched when a mask is given
+    memset(mask, 0, sizeof(mask));
+    CHECK(simage_flood_ex(&img, 0, 0, sg_black, &(simage_flood_desc){.eight_connected = true, .mask = mask, .rw = 2, .rh = 4}));
+    CHECK(mask[0] == 255 && mask[16] == 255 && mask[2] == 0 && (uint32_t)img.buffer[0] == ('a' << 24 | 0xFFu));
+
+    // Without a mask the region is painted, tolerance takes in near colors
+    img.buffer[5] = 'a' << 24 | 0x02FF;
+    simage_flood_ex(&img, 0, 0, simage_unpack_color(0x00FF00FF), &(simage_flood_desc){.tolerance = 2});
+    CHECK((uint32_t)img.buffer[0] == 0x00FF00FF && (uint32_t)img.buffer[5] == 0x00FF00FF && (uint32_t)img.buffer[2] != 0x00FF00FF);
+    simage_destroy_buffer(&img);
+}
+
+int main(int argc, char *argv[]) {
+    digest_fills();
+    digest_blends();
+    digest_resizes();
+    digest_transforms();
+    digest_triangles();
+    test_labels();
+    test_label_strips();
+    test_flood_masks();
+    if (argc == 3 && !strcmp(argv[1], "--write"))
+        CHECK(write_digests(argv[2]));
+    else if (argc == 3 && !strcmp(argv[1], "--compare"))
+        CHECK(compare_digests(argv[2]));
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}